@@ -0,0 +1,192 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file ads1x15_i2c.cpp
+   \brief Read an ADS1X15 ADC directly through the Linux i2c-dev interface
+*/
+
+#include "ads1x15_i2c.h"
+#include "timer.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace {
+// Registers
+const uint8_t reg_conversion = 0x00;
+const uint8_t reg_config = 0x01;
+
+// Config register fields
+const uint16_t cfg_mux_single_0 = 0x4000; // AIN0 to GND, add channel << 12
+const uint16_t cfg_pga_4_096v = 0x0200;   // +/-4.096V, as dtoverlay gain 1
+const uint16_t cfg_mode_continuous = 0x0000;
+const uint16_t cfg_comp_disable = 0x0003;
+
+// Data rates for DR config values 0 - 7 (last two ADS1015 rates are equal)
+const int ads1015_rates[] = {128, 250, 490, 920, 1600, 2400, 3300, 3300};
+const int ads1115_rates[] = {8, 16, 32, 64, 128, 250, 475, 860};
+const int rate_default_idx = 4; // 1600 for ADS1015, 128 for ADS1115
+}; // namespace
+
+Status Ads1x15I2c::open(int bus_no, int addr, const string &chip_name,
+                        int rate)
+{
+  close();
+  bus = bus_no;
+  address = addr;
+
+  if (chip_name == "ads1015")
+    is_ads1015 = true;
+  else if (chip_name == "ads1115")
+    is_ads1015 = false;
+  else
+    return Status::error("unknown ADS1X15 chip '" + chip_name + "'");
+
+  // Lowest rate that is at least the requested rate, or the highest rate
+  const int *rates = (is_ads1015) ? ads1015_rates : ads1115_rates;
+  int rate_idx = rate_default_idx;
+  if (rate > 0)
+    for (rate_idx = 0; rate_idx < 7 && rates[rate_idx] < rate; rate_idx++)
+      ;
+  data_rate = rates[rate_idx];
+  rate_bits = rate_idx << 5;
+
+  string dev_name = "/dev/i2c-" + std::to_string(bus);
+  fd = ::open(dev_name.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return Status::error("could not open " + dev_name + ": " + strerror(errno));
+
+  if (ioctl(fd, I2C_SLAVE, address) < 0) {
+    auto msg = msg_str("could not select I2C address 0x%02x: %s", address,
+                       strerror(errno));
+    close();
+    return Status::error(msg);
+  }
+
+  return Status::ok();
+}
+
+void Ads1x15I2c::close()
+{
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+  cur_channel = -1;
+  reg_is_conv = false;
+}
+
+Status Ads1x15I2c::write_register(uint8_t reg, uint16_t val)
+{
+  uint8_t buf[3] = {reg, uint8_t(val >> 8), uint8_t(val & 0xff)};
+  reg_is_conv = (reg == reg_conversion);
+  if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+    return Status::error(msg_str("could not write ADS1X15 register %d: %s",
+                                 reg, strerror(errno)));
+  return Status::ok();
+}
+
+Status Ads1x15I2c::set_channel(int channel)
+{
+  uint16_t config = cfg_mux_single_0 | uint16_t(channel << 12) |
+                    cfg_pga_4_096v | cfg_mode_continuous | rate_bits |
+                    cfg_comp_disable;
+  cur_channel = -1;
+  Status stat = write_register(reg_config, config);
+  if (!stat)
+    return stat;
+
+  // The first conversion for the new channel completes within two
+  // conversion periods (the conversion in progress may be discarded)
+  usleep(2 * 1000000 / data_rate + 100);
+  cur_channel = channel;
+  return Status::ok();
+}
+
+Status Ads1x15I2c::read(int channel, long long *raw)
+{
+  lock.lock();
+  auto stat = read_conversion(channel, raw);
+  lock.unlock();
+  return stat;
+}
+
+Status Ads1x15I2c::read_conversion(int channel, long long *raw)
+{
+  if (fd < 0)
+    return Status::error("ADS1X15 I2C device is not open");
+
+  if (channel < 0 || channel > 3)
+    return Status::error(msg_str("invalid ADS1X15 channel %d", channel));
+
+  Status stat;
+  if (channel != cur_channel && !(stat = set_channel(channel)))
+    return stat;
+
+  // Point at the conversion register once, then each read is one transfer
+  if (!reg_is_conv) {
+    uint8_t reg = reg_conversion;
+    if (write(fd, &reg, 1) != 1)
+      return Status::error(string("could not select ADS1X15 conversion "
+                                  "register: ") +
+                           strerror(errno));
+    reg_is_conv = true;
+  }
+
+  uint8_t buf[2];
+  if (::read(fd, buf, sizeof(buf)) != sizeof(buf))
+    return Status::error(string("could not read ADS1X15 conversion: ") +
+                         strerror(errno));
+
+  // Same scale as the kernel driver: 16 bit signed, or 12 bit signed
+  // for the ADS1015 (whose 12 bit value is left aligned)
+  auto val = int16_t((buf[0] << 8) | buf[1]);
+  *raw = (is_ads1015) ? val >> 4 : val;
+  return Status::ok();
+}
+
+string Ads1x15I2c::get_description() const
+{
+  return msg_str("%s on /dev/i2c-%d address 0x%02x, %d samples/sec",
+                 (is_ads1015) ? "ADS1015" : "ADS1115", bus, address,
+                 data_rate);
+}
+
+Status I2cInput::read(long long *raw, timeval *sample_time)
+{
+  auto stat = adc->read(chan, raw);
+  get_monotonic_time(sample_time);
+  return stat;
+}
+
+string I2cInput::get_description() const
+{
+  return msg_str("%s channel %d", adc->get_description().c_str(), chan);
+}
@@ -0,0 +1,109 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file ads1x15_i2c.h
+   \brief Read an ADS1X15 ADC directly through the Linux i2c-dev interface
+*/
+
+#ifndef ADS1X15_I2C_H
+#define ADS1X15_I2C_H
+
+#include "input.h"
+#include "status_msg.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/// ADS1115 or ADS1015 in continuous-conversion mode, accessed over i2c-dev
+class Ads1x15I2c {
+public:
+  /// Destructor, closes the I2C device
+  ~Ads1x15I2c() { close(); }
+
+  /// Open the I2C device for the ADC
+  /**\param bus the I2C bus number (for \c /dev/i2c-bus)
+   * \param address the I2C address of the ADC
+   * \param chip_name \c "ads1115" or \c "ads1015"
+   * \param data_rate samples per second, the lowest chip rate that is
+   *  at least this value is used (or the highest chip rate), 0 for the
+   *  chip default rate
+   * \return status, evaluates to \c true if the device was opened. */
+  Status open(int bus, int address, const std::string &chip_name,
+              int data_rate = 0);
+
+  /// Close the I2C device
+  void close();
+
+  /// Read the latest conversion for a channel
+  /** Reading the same channel as the last read only transfers the two
+   *  bytes of the conversion register. Reading a different channel
+   *  reprograms the multiplexer and waits for a new conversion.
+   *  The value has the same scale as the kernel driver raw value.
+   * \param channel the channel number, 0 - 3
+   * \param raw used to return the reading
+   * \return status, evaluates to \c true if the reading was made. */
+  Status read(int channel, long long *raw);
+
+  /// Get the data rate
+  /**\return The number of conversions per second */
+  int get_data_rate() const { return data_rate; }
+
+  /// Get a description of the device
+  /**\return The description */
+  std::string get_description() const;
+
+private:
+  Status read_conversion(int channel, long long *raw);
+  Status write_register(uint8_t reg, uint16_t val);
+  Status set_channel(int channel);
+
+  int fd = -1;              // I2C device file descriptor
+  int bus = 0;              // I2C bus number
+  int address = 0;          // I2C address
+  bool is_ads1015 = false;  // 12 bit ADS1015, otherwise 16 bit ADS1115
+  int data_rate = 0;        // conversions per second
+  uint16_t rate_bits = 0;   // data rate bits for the config register
+  int cur_channel = -1;     // channel currently converted, -1 if none
+  bool reg_is_conv = false; // pointer register is at the conversion register
+  std::mutex lock;          // channels share the multiplexer
+};
+
+/// Input source reading a channel of an ADS1X15 accessed over i2c-dev
+class I2cInput : public InputSource {
+public:
+  /// Constructor
+  /**\param adc the ADC
+   * \param chan the channel number, 0 - 3 */
+  I2cInput(Ads1x15I2c *adc, int chan) : adc(adc), chan(chan) {}
+  Status read(long long *raw, timeval *sample_time) override;
+  std::string get_description() const override;
+  const void *get_device() const override { return adc; }
+
+private:
+  Ads1x15I2c *adc;
+  int chan;
+};
+
+#endif // ADS1X15_I2C_H
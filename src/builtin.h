@@ -0,0 +1,156 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file builtin.h
+   \brief Configuration compiled into the program, see turnandrun -E
+*/
+
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <cstdint>
+#include <limits>
+
+/// Band of readings, see DialBands
+struct BuiltinBand {
+  long start;  ///< first reading in the band
+  long select; ///< mark selected by a reading in the band
+  long stay;   ///< other mark kept by a reading in the band
+};
+
+/// Command for a mark
+struct BuiltinCommand {
+  long mark;           ///< dial reading of the mark
+  const char *label;   ///< command label
+  const char *command; ///< command to run
+};
+
+/// Reading, with the mark the configuration gave for it
+struct BuiltinCheck {
+  long reading;  ///< the reading
+  long cur_mark; ///< the current mark before the reading
+  long mark;     ///< the mark after the reading
+};
+
+/// Settings, compiled bands and commands of a channel
+/** Written by turnandrun -E, with the fields in this order. */
+struct BuiltinChannel {
+  int idx; ///< channel index, 0 for channel a
+
+  // settings, see DialSettings
+  const char *input;
+  const char *oversample;
+  const char *filter;
+  bool turn_before_run;
+  double command_delay;
+  const char *settle_mode;
+  double settle_velocity;
+  int settle_window;
+  double settle_noise;
+  double overlap; ///< fraction of a band, not a percentage
+  double frequency;
+  double frequency_idle;
+  bool event_wakeup;
+  double idle_delay;
+  bool run_commands;
+  bool print_commands;
+
+  const BuiltinCommand *commands; ///< commands in mark order
+  int num_commands;
+  const BuiltinBand *bands; ///< bands in reading order
+  int num_bands;
+  const uint16_t *table; ///< first band in each slot, see DialBands
+  int table_size;
+  long table_base;
+  int table_shift;
+  const BuiltinCheck *checks; ///< readings to check the bands with
+  int num_checks;
+};
+
+/// Mark for no mark, the same as DialBands::unset
+constexpr long builtin_unset = std::numeric_limits<long>::min();
+
+/// Find the band that includes a reading
+/** The same search as the DialBands lookup table, or a binary search if
+ *  the channel has no table.
+ * \param chan the channel, which must have bands
+ * \param kval the reading
+ * \return The band. */
+constexpr const BuiltinBand &builtin_find_band(const BuiltinChannel &chan,
+                                               long kval)
+{
+  if (chan.table_size == 0) {
+    int low = 0; // the last band starting at or before kval
+    int high = chan.num_bands;
+    while (high - low > 1) {
+      const int mid = (low + high) / 2;
+      if (chan.bands[mid].start <= kval)
+        low = mid;
+      else
+        high = mid;
+    }
+    return chan.bands[low];
+  }
+
+  if (kval <= chan.table_base)
+    return chan.bands[0];
+  const unsigned long slot =
+      ((unsigned long)kval - (unsigned long)chan.table_base) >>
+      chan.table_shift;
+  if (slot >= (unsigned long)chan.table_size)
+    return chan.bands[chan.num_bands - 1];
+  int band = chan.table[slot];
+  while (band + 1 < chan.num_bands && chan.bands[band + 1].start <= kval)
+    band++;
+  return chan.bands[band];
+}
+
+/// Get the mark for a reading
+/**\param chan the channel
+ * \param kval the reading
+ * \param cur_mark the current mark
+ * \return The mark, or builtin_unset if the channel has no bands. */
+constexpr long builtin_get_mark(const BuiltinChannel &chan, long kval,
+                                long cur_mark)
+{
+  if (chan.num_bands == 0)
+    return builtin_unset;
+  const BuiltinBand &band = builtin_find_band(chan, kval);
+  return (cur_mark == band.stay || cur_mark == band.select) ? cur_mark
+                                                            : band.select;
+}
+
+/// Check the compiled bands give the marks of the configuration
+/**\param chan the channel
+ * \return \c true if every check reading gives its mark. */
+constexpr bool builtin_check(const BuiltinChannel &chan)
+{
+  for (int i = 0; i < chan.num_checks; i++)
+    if (builtin_get_mark(chan, chan.checks[i].reading,
+                         chan.checks[i].cur_mark) != chan.checks[i].mark)
+      return false;
+  return true;
+}
+
+#endif // BUILTIN_H
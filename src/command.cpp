@@ -0,0 +1,133 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file command.cpp
+   \brief Run shell commands in a child process
+*/
+
+#include "command.h"
+#include "timer.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace {
+cpu_set_t command_cpus;        // CPUs for commands to run on
+bool has_command_cpus = false; // whether the command CPUs are set
+}; // namespace
+
+void CommandRunner::set_command_cpus(const cpu_set_t &cpus)
+{
+  command_cpus = cpus;
+  has_command_cpus = true;
+}
+
+CommandRunner::Times CommandRunner::submit_times(const timeval *turn)
+{
+  Times times = {};
+  get_monotonic_time(&times.submit);
+  times.turn = turn ? *turn : times.submit;
+  return times;
+}
+
+void CommandRunner::finished()
+{
+  pid = -1;
+  if (finish_fn) {
+    get_monotonic_time(&running_times.exit);
+    finish_fn(running_times);
+  }
+}
+
+Status CommandRunner::spawn(const string &cmd, const Times &times)
+{
+  running_times = times;
+  pid_t child = fork();
+  if (child < 0)
+    return Status::error(string("could not start command: ") +
+                         strerror(errno));
+
+  if (child == 0) { // child process
+    // The program blocks signals to handle them in one thread, but the
+    // command should receive them as usual
+    sigset_t no_sigs;
+    sigemptyset(&no_sigs);
+    sigprocmask(SIG_SETMASK, &no_sigs, nullptr);
+
+    // The reading thread may have real-time scheduling and be pinned to
+    // a CPU, but the command should not compete with it
+    sched_param param = {};
+    sched_setscheduler(0, SCHED_OTHER, &param);
+    if (has_command_cpus)
+      sched_setaffinity(0, sizeof(command_cpus), &command_cpus);
+    execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *)nullptr);
+    _exit(127); // only reached if exec failed
+  }
+
+  pid = child;
+  get_monotonic_time(&running_times.spawn);
+  return Status::ok();
+}
+
+Status CommandRunner::run(const string &cmd, const timeval *turn)
+{
+  Status stat = spawn(cmd, submit_times(turn));
+  if (stat) {
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR)
+      ;
+    finished();
+  }
+  return stat;
+}
+
+Status CommandRunner::submit(const string &cmd, const timeval *turn)
+{
+  poll(); // reap a finished command, if there is one
+  if (is_running()) {
+    queued = cmd;
+    queued_times = submit_times(turn);
+    has_queued = true;
+    return Status::ok();
+  }
+
+  return spawn(cmd, submit_times(turn));
+}
+
+Status CommandRunner::poll()
+{
+  if (is_running() && waitpid(pid, nullptr, WNOHANG) != 0)
+    finished(); // finished (or no longer a child of this process)
+
+  if (!is_running() && has_queued) {
+    has_queued = false;
+    return spawn(queued, queued_times);
+  }
+
+  return Status::ok();
+}
@@ -0,0 +1,106 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file command.h
+   \brief Run shell commands in a child process
+*/
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "status_msg.h"
+
+#include <functional>
+#include <sched.h>
+#include <string>
+#include <sys/time.h>
+#include <sys/types.h>
+
+/// Run shell commands, waiting for them to finish, or in the background
+class CommandRunner {
+public:
+  /// Times of the stages of running a command, on the monotonic clock
+  struct Times {
+    timeval turn;   ///< time of the event that led to the command
+    timeval submit; ///< time the command was run or submitted
+    timeval spawn;  ///< time the command process was created
+    timeval exit;   ///< time the command was seen to have finished
+  };
+
+  /// Set a function to call with the stage times when a command finishes
+  /**\param on_finish the function, or an empty function for none. */
+  void set_on_finish(std::function<void(const Times &)> on_finish)
+  {
+    finish_fn = std::move(on_finish);
+  }
+
+  /// Run a command and wait for it to finish (like \c system())
+  /**\param cmd the command to run with \c /bin/sh
+   * \param turn time of the event that led to the command, or \c nullptr
+   *  to use the current time (see Times)
+   * \return status, evaluates to \c true if the command was started. */
+  Status run(const std::string &cmd, const timeval *turn = nullptr);
+
+  /// Run a command without waiting for it to finish.
+  /** Only one command runs at a time. If a command is already running
+   *  then \a cmd is queued, replacing any command already queued, and is
+   *  started by poll() when the running command has finished.
+   * \param cmd the command to run with \c /bin/sh
+   * \param turn time of the event that led to the command, or \c nullptr
+   *  to use the current time (see Times)
+   * \return status, evaluates to \c true if the command was started or
+   *  queued. */
+  Status submit(const std::string &cmd, const timeval *turn = nullptr);
+
+  /// Check whether a background command has finished, and if so start
+  /// any queued command.
+  /**\return status, evaluates to \c true unless a queued command could
+   *  not be started. */
+  Status poll();
+
+  /// Set the CPUs that commands run on
+  /** Commands always run with normal scheduling, whatever the scheduling
+   *  of the thread that starts them, and on the CPUs of that thread unless
+   *  this is called.
+   * \param cpus the CPUs. */
+  static void set_command_cpus(const cpu_set_t &cpus);
+
+  /// Check whether a background command is running
+  /**\return \c true if a command is running, otherwise \c false. */
+  bool is_running() const { return pid > 0; }
+
+private:
+  Status spawn(const std::string &cmd, const Times &times);
+  void finished();
+  static Times submit_times(const timeval *turn);
+
+  pid_t pid = -1;            // process id of running command
+  bool has_queued = false;   // whether a command is waiting to run
+  std::string queued;        // command waiting to run
+  Times running_times;       // stage times of the running command
+  Times queued_times;        // stage times of the queued command
+  std::function<void(const Times &)> finish_fn; // called when finished
+};
+
+#endif // COMMAND_H
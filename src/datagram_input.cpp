@@ -0,0 +1,203 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file datagram_input.cpp
+   \brief Receive raw dial readings as datagrams on a UDP or Unix socket
+*/
+
+#include "datagram_input.h"
+#include "timer.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace {
+// Parse a reading, as decimal text with optional surrounding whitespace
+bool parse_reading(const char *buf, size_t len, long long *val)
+{
+  char str[32];
+  if (len == 0 || len >= sizeof(str))
+    return false;
+  memcpy(str, buf, len);
+  str[len] = '\0';
+  char *end;
+  errno = 0;
+  *val = strtoll(str, &end, 10);
+  if (end == str || errno)
+    return false;
+  while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+    end++;
+  return *end == '\0';
+}
+}; // namespace
+
+DatagramInput::~DatagramInput()
+{
+  if (fd >= 0)
+    close(fd);
+  if (!unix_path.empty())
+    unlink(unix_path.c_str());
+}
+
+Status DatagramInput::init_udp(const string &address, const string &port)
+{
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  addrinfo *res;
+  int ret = getaddrinfo(address.empty() ? nullptr : address.c_str(),
+                        port.c_str(), &hints, &res);
+  if (ret != 0)
+    return Status::error("invalid address '" + address + ":" + port +
+                         "': " + gai_strerror(ret));
+
+  // Bind to the first address that works
+  int err = 0;
+  for (auto ai = res; ai != nullptr && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                ai->ai_protocol);
+    if (fd >= 0 && bind(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+      err = errno;
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  if (fd < 0)
+    return Status::error("could not bind UDP port " + port + ": " +
+                         strerror(err ? err : errno));
+
+  description = "UDP " + (address.empty() ? string("*") : address) + ":" + port;
+  return Status::ok();
+}
+
+Status DatagramInput::init_unix(const string &path)
+{
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    return Status::error("invalid socket file name '" + path + "'");
+  strcpy(addr.sun_path, path.c_str());
+
+  // Replace a socket file left by an earlier run, but not any other file
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path.c_str());
+
+  fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+    return Status::error("could not bind Unix socket '" + path +
+                         "': " + strerror(errno));
+  unix_path = path;
+
+  description = "Unix socket " + path;
+  return Status::ok();
+}
+
+Status DatagramInput::receive()
+{
+  // Drain the socket in batches, keeping only the newest valid reading
+  // (invalid datagrams are ignored)
+  const int batch = 16;
+  char bufs[batch][32];
+  iovec iovs[batch];
+  mmsghdr msgs[batch];
+  for (int i = 0; i < batch; i++) {
+    iovs[i] = {bufs[i], sizeof(bufs[i])};
+    msgs[i] = {};
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int num;
+  while ((num = recvmmsg(fd, msgs, batch, MSG_DONTWAIT, nullptr)) > 0) {
+    for (int i = num - 1; i >= 0; i--) {
+      long long val;
+      if (!(msgs[i].msg_hdr.msg_flags & MSG_TRUNC) &&
+          parse_reading(bufs[i], msgs[i].msg_len, &val)) {
+        last_raw = val;
+        has_reading = true;
+        break;
+      }
+    }
+    if (num < batch)
+      break; // socket is empty
+  }
+  if (num < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    return Status::error(string("could not receive reading: ") +
+                         strerror(errno));
+  return Status::ok();
+}
+
+Status DatagramInput::read(long long *raw, timeval *sample_time)
+{
+  Status stat;
+  if (!(stat = receive()))
+    return stat;
+
+  // There is no reading until the sender has sent one
+  while (!has_reading) {
+    if (!(stat = wait(-1)) || !(stat = receive()))
+      return stat;
+  }
+
+  *raw = last_raw;
+  get_monotonic_time(sample_time);
+  return Status::ok();
+}
+
+Status DatagramInput::read_no_wait(long long *raw, timeval *sample_time,
+                                   bool *has_read)
+{
+  *has_read = false;
+  Status stat;
+  if (!(stat = receive()) || !has_reading)
+    return stat;
+
+  *raw = last_raw;
+  get_monotonic_time(sample_time);
+  *has_read = true;
+  return Status::ok();
+}
+
+Status DatagramInput::wait(double secs)
+{
+  const int msecs = wait_timeout_msecs(secs);
+  pollfd pfd = {fd, POLLIN, 0};
+  if (poll(&pfd, 1, msecs) < 0 && errno != EINTR)
+    return Status::error(string("could not wait for readings: ") +
+                         strerror(errno));
+  return Status::ok();
+}
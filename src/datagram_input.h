@@ -0,0 +1,81 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file datagram_input.h
+   \brief Receive raw dial readings as datagrams on a UDP or Unix socket
+*/
+
+#ifndef DATAGRAM_INPUT_H
+#define DATAGRAM_INPUT_H
+
+#include "input.h"
+#include "status_msg.h"
+
+#include <string>
+
+/// Input source receiving readings sent by another program or device
+/** Each datagram contains one raw reading as decimal text, e.g. \c "12345".
+ *  Only the newest reading is used when several have arrived. */
+class DatagramInput : public InputSource {
+public:
+  /// Destructor, closes the socket
+  ~DatagramInput();
+
+  /// Bind a UDP socket
+  /**\param address the local address, or an empty string for all
+   *  addresses
+   * \param port the port number
+   * \return status, evaluates to \c true if the socket was bound. */
+  Status init_udp(const std::string &address, const std::string &port);
+
+  /// Bind a Unix datagram socket
+  /**\param path the socket file name, an existing socket file is replaced
+   * \return status, evaluates to \c true if the socket was bound. */
+  Status init_unix(const std::string &path);
+
+  /// Read the newest reading
+  /** Waits for the first reading, then returns the newest reading that
+   *  has been received, which is the previous reading if there is no
+   *  new one.
+   * \param raw used to return the reading
+   * \param sample_time used to return the current time
+   * \return status, evaluates to \c true if the reading was made. */
+  Status read(long long *raw, timeval *sample_time) override;
+  Status read_no_wait(long long *raw, timeval *sample_time,
+                      bool *has_read) override;
+  std::string get_description() const override { return description; }
+  int get_event_fd() const override { return fd; }
+  Status wait(double secs) override;
+
+private:
+  Status receive();
+
+  int fd = -1;                // socket
+  std::string unix_path;      // Unix socket file to remove, if set
+  bool has_reading = false;   // a valid reading has been received
+  long long last_raw = 0;     // newest reading
+  std::string description;
+};
+
+#endif // DATAGRAM_INPUT_H
@@ -22,19 +22,164 @@
   IN THE SOFTWARE.
 */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "dial.h"
 #include "utils.h"
 
+#ifdef BUILTIN_CONFIG_FILE
+#include BUILTIN_CONFIG_FILE
+#endif
+
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
 #include <cstring>
+#include <csignal>
+#include <pthread.h>
+#include <random>
+#include <sched.h>
 #include <set>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <thread>
+#include <unistd.h>
 
 using std::string;
 using std::vector;
 
+void DialBands::compile()
+{
+  table.clear();
+  keys.clear();
+  vals.clear();
+  if (bands.empty() || bands.size() > std::numeric_limits<uint16_t>::max())
+    return; // use the map
+
+  for (const auto &kp : bands) {
+    keys.push_back(kp.first);
+    vals.push_back(kp.second);
+  }
+
+  // Readings from the first band start to the last band start are split
+  // into slots of a power of two readings, so the slot is found with a
+  // shift. Each slot holds the band that includes its first reading.
+  table_base = keys.front();
+  const unsigned long span = keys.back() - keys.front();
+  table_shift = 0;
+  while ((span >> table_shift) >= (unsigned long)max_table_size)
+    table_shift++;
+  const size_t num_slots = (span >> table_shift) + 1;
+  table.resize(num_slots);
+  size_t band = 0;
+  for (size_t slot = 0; slot < num_slots; slot++) {
+    const long slot_start = table_base + long(slot << table_shift);
+    while (band + 1 < keys.size() && keys[band + 1] <= slot_start)
+      band++;
+    table[slot] = band;
+  }
+}
+
+const std::pair<long, long> &DialBands::find_band(long kval) const
+{
+  // Readings before the first band use the first band, and readings
+  // after the last band start use the last band
+  if (kval <= table_base)
+    return vals.front();
+  const unsigned long slot =
+      ((unsigned long)kval - (unsigned long)table_base) >> table_shift;
+  if (slot >= table.size())
+    return vals.back();
+
+  // A slot may include the start of following bands
+  size_t band = table[slot];
+  while (band + 1 < keys.size() && keys[band + 1] <= kval)
+    band++;
+  return vals[band];
+}
+
+namespace {
+// Get the mark from the band for a reading
+long band_mark(const std::pair<long, long> &vals, long cur_mark)
+{
+  const long jump = vals.first;
+  const long stay = vals.second;
+  return (cur_mark == stay || cur_mark == jump) ? cur_mark : jump;
+}
+}; // namespace
+
+void DialBands::add_run(long first, long step, long num_steps,
+                        const std::map<long, std::pair<long, long>> &step_bands)
+{
+  Run run = {first, step, first + num_steps * step, {}};
+  for (const auto &kp : step_bands)
+    run.bands.push_back(
+        {kp.first, kp.second.first == step, kp.second.second == step});
+  auto it = std::upper_bound(
+      runs.begin(), runs.end(), first,
+      [](long kval, const Run &other) { return kval < other.first; });
+  runs.insert(it, std::move(run));
+}
+
+const DialBands::Run *DialBands::find_run(long kval) const
+{
+  auto it = std::upper_bound(
+      runs.begin(), runs.end(), kval,
+      [](long k, const Run &run) { return k < run.first; });
+  if (it == runs.begin())
+    return nullptr;
+  --it; // the last run starting at or before kval
+  return (kval < it->end) ? &*it : nullptr;
+}
+
+std::pair<long, long> DialBands::run_band(const Run &run, long kval) const
+{
+  // The band is found from the offset of the reading from the mark below
+  const long lower = run.first + (kval - run.first) / run.step * run.step;
+  const long upper = lower + run.step;
+  const long offset = kval - lower;
+  for (auto it = run.bands.rbegin(); it != run.bands.rend(); ++it)
+    if (it->offset <= offset)
+      return {it->select_upper ? upper : lower, it->stay_upper ? upper : lower};
+  return {lower, lower}; // the last band between lower and the mark below
+}
+
+std::pair<long, long> DialBands::band_at(long kval) const
+{
+  if (!runs.empty()) {
+    if (const auto run = find_run(kval))
+      return run_band(*run, kval);
+  }
+  if (!table.empty())
+    return find_band(kval);
+  auto it = bands.upper_bound(kval);
+  if (it != bands.begin())
+    --it; // band that includes kval
+  return it->second;
+}
+
 long DialBands::get_mark(long kval, long cur_mark) const
 {
+  if (!runs.empty()) {
+    if (const auto run = find_run(kval))
+      return band_mark(run_band(*run, kval), cur_mark);
+  }
+  if (table.empty())
+    return get_mark_by_map(kval, cur_mark);
+  return band_mark(find_band(kval), cur_mark);
+}
+
+long DialBands::get_mark_by_map(long kval, long cur_mark) const
+{
+  if (!runs.empty()) {
+    if (const auto run = find_run(kval))
+      return band_mark(run_band(*run, kval), cur_mark);
+  }
   long mark = unset;
   auto it_after = bands.upper_bound(kval);
   if (bands.size() > 0) {
@@ -46,16 +191,73 @@ long DialBands::get_mark(long kval, long cur_mark) const
     else
       vals = (--it_after)->second; // use start of including band
 
-    const long jump = vals.first;
-    const long stay = vals.second;
-    if (cur_mark == stay || cur_mark == jump)
-      mark = cur_mark;
-    else
-      mark = jump;
+    mark = band_mark(vals, cur_mark);
   }
   return mark;
 }
 
+bool DialBands::get_mark_range(long mark, long *low, long *high) const
+{
+  // The bands that keep a mark are consecutive, the first band extends
+  // down indefinitely and the last band extends up indefinitely
+  *low = unset;
+  *high = std::numeric_limits<long>::max();
+
+  // Bands of runs are only needed for the steps either side of the mark,
+  // as the bands of other steps do not keep it. They are made in reading
+  // order, as runs do not overlap, and are merged with the bands added with
+  // add_band(), taking precedence at the same reading.
+  vector<std::pair<long, std::pair<long, long>>> run_bands;
+  for (const auto &run : runs) {
+    if (mark < run.first || mark > run.end || (mark - run.first) % run.step)
+      continue;
+    for (long lower : {mark - run.step, mark}) {
+      if (lower < run.first || lower >= run.end)
+        continue;
+      const long upper = lower + run.step;
+      for (const auto &band : run.bands)
+        run_bands.push_back({lower + band.offset,
+                             {band.select_upper ? upper : lower,
+                              band.stay_upper ? upper : lower}});
+    }
+  }
+
+  bool found = false;
+  bool first_band = true;
+  auto it = bands.begin();
+  auto run_it = run_bands.begin();
+  while (it != bands.end() || run_it != run_bands.end()) {
+    long kval;
+    std::pair<long, long> vals;
+    if (run_it != run_bands.end() &&
+        (it == bands.end() || run_it->first <= it->first)) {
+      if (it != bands.end() && it->first == run_it->first)
+        ++it; // replaced by the run band
+      kval = run_it->first;
+      vals = run_it->second;
+      ++run_it;
+    }
+    else {
+      kval = it->first;
+      vals = it->second;
+      ++it;
+    }
+
+    const bool keeps_mark = (vals.first == mark || vals.second == mark);
+    if (keeps_mark && !found) {
+      found = true;
+      if (!first_band)
+        *low = kval;
+    }
+    else if (!keeps_mark && found) {
+      *high = kval;
+      break;
+    }
+    first_band = false;
+  }
+  return found;
+}
+
 Status DialSettings::set_command(int dial_reading, std::string cmd_label,
                                  std::string cmd_command)
 {
@@ -68,273 +270,2163 @@ Status DialSettings::set_command(int dial_reading, std::string cmd_label,
   if (cmd_command.empty())
     return Status::error("no command given");
 
+  for (const auto &range : ranges)
+    if (dial_reading >= range.start && dial_reading <= range.last())
+      return Status::error(msg_str("dial reading %d is in the range of "
+                                   "marks %ld..%ld",
+                                   dial_reading, range.start, range.last()));
+
   commands[dial_reading] = {cmd_label, cmd_command};
 
-  return Status::ok();
+  return Status::ok();
+}
+
+Status DialSettings::set_command_range(const string &range,
+                                       std::string cmd_label,
+                                       std::string cmd_command)
+{
+  const string format_msg =
+      "range '" + range + "' is not start..end step step [values first..last]";
+  CommandRange rng;
+  long end;
+  int pos = 0;
+  if (sscanf(range.c_str(), " %ld .. %ld step %ld %n", &rng.start, &end,
+             &rng.step, &pos) != 3 ||
+      pos == 0)
+    return Status::error(format_msg);
+  const char *values = range.c_str() + pos;
+  bool values_set = false;
+  if (*values) {
+    pos = 0;
+    if (sscanf(values, "values %ld .. %ld %n", &rng.value_first,
+               &rng.value_last, &pos) != 2 ||
+        values[pos] != '\0')
+      return Status::error(format_msg);
+    values_set = true;
+  }
+
+  if (rng.start < 0)
+    return Status::error("dial reading cannot be negative");
+  if (end < rng.start)
+    return Status::error("range end is before its start");
+  if (rng.step < 1)
+    return Status::error("range step must be a positive integer");
+  if (end > std::numeric_limits<int>::max())
+    return Status::error("range end is too large");
+  if (cmd_label.empty())
+    return Status::error("no command label given");
+  if (cmd_command.empty())
+    return Status::error("no command given");
+
+  rng.count = (end - rng.start) / rng.step + 1;
+  if (!values_set) {
+    rng.value_first = 0;
+    rng.value_last = rng.count - 1;
+  }
+  rng.label = cmd_label;
+  rng.command = cmd_command;
+
+  auto it = commands.lower_bound(rng.start);
+  if (it != commands.end() && it->first <= rng.last())
+    return Status::error(msg_str("dial reading %ld is in the range of marks",
+                                 it->first));
+  for (const auto &other : ranges)
+    if (other.start <= rng.last() && rng.start <= other.last())
+      return Status::error(msg_str("range overlaps the range of marks "
+                                   "%ld..%ld",
+                                   other.start, other.last()));
+
+  ranges.insert(std::upper_bound(ranges.begin(), ranges.end(), rng.start,
+                                 [](long start, const CommandRange &other) {
+                                   return start < other.start;
+                                 }),
+                rng);
+  return Status::ok();
+}
+
+namespace {
+// Replace each field in a template with its value
+string fill_template(const string &tmpl, long idx, long mark, long value)
+{
+  string str;
+  for (size_t pos = 0; pos < tmpl.size();) {
+    const auto open = tmpl.find('{', pos);
+    if (open == string::npos) {
+      str += tmpl.substr(pos);
+      break;
+    }
+    str += tmpl.substr(pos, open - pos);
+    const auto close = tmpl.find('}', open);
+    const auto field = tmpl.substr(open, close + 1 - open);
+    if (field == "{i}")
+      str += std::to_string(idx);
+    else if (field == "{mark}")
+      str += std::to_string(mark);
+    else if (field == "{value}")
+      str += std::to_string(value);
+    else {
+      str += '{'; // not a field
+      pos = open + 1;
+      continue;
+    }
+    pos = close + 1;
+  }
+  return str;
+}
+}; // namespace
+
+bool DialSettings::get_range_command(long mark, Command *cmd) const
+{
+  auto it = std::upper_bound(ranges.begin(), ranges.end(), mark,
+                             [](long kval, const CommandRange &range) {
+                               return kval < range.start;
+                             });
+  if (it == ranges.begin())
+    return false;
+  const auto &range = *--it; // the last range starting at or before mark
+  if (mark > range.last() || (mark - range.start) % range.step)
+    return false;
+
+  const long idx = (mark - range.start) / range.step;
+  long value = range.value_first;
+  if (range.count > 1)
+    value += std::lround(double(idx) * (range.value_last - range.value_first) /
+                         (range.count - 1));
+  cmd->label = fill_template(range.label, idx, mark, value);
+  cmd->command = fill_template(range.command, idx, mark, value);
+  return true;
+}
+
+long DialSettings::get_num_marks() const
+{
+  long num_marks = commands.size();
+  for (const auto &range : ranges)
+    num_marks += range.count;
+  return num_marks;
+}
+
+DialSettings DialSettings::expanded() const
+{
+  DialSettings settings = *this;
+  settings.ranges.clear();
+  for (const auto &range : ranges)
+    for (long i = 0; i < range.count; i++)
+      get_range_command(range.mark(i), &settings.commands[range.mark(i)]);
+  return settings;
+}
+
+ChannelProgram::ChannelProgram(const DialSettings &dial_settings)
+    : ChannelProgram(dial_settings, dial_settings.create_dial_bands())
+{
+}
+
+ChannelProgram::ChannelProgram(const DialSettings &dial_settings,
+                               DialBands dial_bands)
+    : settings(dial_settings), bands(std::move(dial_bands))
+{
+  for (const auto &kp : settings.get_commands()) {
+    command_marks.push_back(kp.first);
+    commands.push_back(kp.second);
+  }
+}
+
+bool ChannelProgram::get_command(long mark, DialSettings::Command *cmd) const
+{
+  auto it = std::lower_bound(command_marks.begin(), command_marks.end(), mark);
+  if (it == command_marks.end() || *it != mark)
+    return settings.get_range_command(mark, cmd);
+  *cmd = commands[it - command_marks.begin()];
+  return true;
+}
+
+std::string ChannelProgram::report() const
+{
+  return "-- Configuration Settings --\n" + settings.settings_report() +
+         "-- Band Settings --\n" + settings.dial_bands_report(bands);
+}
+
+void Dial::compile_program()
+{
+  std::shared_ptr<const ChannelProgram> new_program;
+  if (builtin) {
+    DialBands bands;
+    bands.set_compiled(*builtin);
+    new_program = std::make_shared<ChannelProgram>(settings, std::move(bands));
+  }
+  else
+    new_program = std::make_shared<ChannelProgram>(settings);
+  std::atomic_store(&program, new_program);
+  program_gen.fetch_add(1, std::memory_order_release);
+}
+
+DialSettings::Command DialSettings::get_command(long dial_reading) const
+{
+  auto it = commands.find(dial_reading);
+  if (it != commands.end())
+    return it->second;
+  Command cmd;
+  get_range_command(dial_reading, &cmd);
+  return cmd;
+}
+
+const char *DialSettings::settle_mode_name(SettleMode mode)
+{
+  switch (mode) {
+  case SettleMode::predict:
+    return "predict";
+  case SettleMode::variance:
+    return "variance";
+  default:
+    return "delay";
+  }
+}
+
+bool DialSettings::find_settle_mode(const string &name, SettleMode *mode)
+{
+  for (auto m : {SettleMode::delay, SettleMode::predict, SettleMode::variance})
+    if (name == settle_mode_name(m)) {
+      *mode = m;
+      return true;
+    }
+  return false;
+}
+
+Status DialSettings::set_setting(std::string setting, std::string value)
+{
+  if (setting.empty())
+    return Status::error("no setting given");
+
+  if (value.empty())
+    return Status::error("no value given");
+
+  string msg_prefix = "setting '" + setting + "': ";
+  // frequency_active is another name for frequency
+  if (setting == "frequency_active")
+    setting = "frequency";
+
+  if (setting == "overlap" || setting == "command_delay" ||
+      setting == "frequency" || setting == "frequency_idle" ||
+      setting == "idle_delay" || setting == "settle_velocity" ||
+      setting == "settle_window" || setting == "settle_noise") {
+    string msg_prefix2 = msg_prefix + "value '" + value + "': ";
+    double num;
+    Status stat = read_double(value.c_str(), &num);
+    if (!stat)
+      return Status::error(msg_prefix2 + "not a number: " + stat.msg());
+
+    int lim_low = (setting == "frequency")       ? 1
+                  : (setting == "settle_window") ? 2
+                                                 : 0;
+    int lim_high = (setting == "command_delay") ? 10
+                   : (setting == "frequency")   ? 3300 // ADS1015 maximum
+                   : (setting == "frequency_idle") ? 3300
+                   : (setting == "idle_delay")  ? 3600
+                   : (setting == "settle_velocity") ? 1000000
+                   : (setting == "settle_window") ? RollingStats::max_window
+                   : (setting == "settle_noise")  ? 100000
+                                                : 50;
+    if (num < lim_low || num > lim_high)
+      return Status::error(msg_prefix2 + "must be in range " +
+                           std::to_string(lim_low) + " to " +
+                           std::to_string(lim_high));
+
+    if (setting == "overlap")
+      overlap = num / 100;
+    else if (setting == "command_delay")
+      command_delay = num;
+    else if (setting == "idle_delay")
+      idle_delay = num;
+    else if (setting == "settle_velocity")
+      settle_velocity = num;
+    else if (setting == "settle_window") {
+      if (num != int(num))
+        return Status::error(msg_prefix2 + "not an integer");
+      settle_window = num;
+    }
+    else if (setting == "settle_noise")
+      settle_noise = num;
+    else if (setting == "frequency_idle")
+      frequency_idle = num;
+    else // setting == frquency
+      frequency = num;
+  }
+  else if (setting == "input") {
+    Status stat = check_input_spec(value);
+    if (!stat)
+      return Status::error(msg_prefix + stat.msg());
+    input = value;
+  }
+  else if (setting == "settle_mode") {
+    if (!find_settle_mode(value, &settle_mode))
+      return Status::error(msg_prefix + "value '" + value +
+                           "': must be delay, predict or variance");
+  }
+  else if (setting == "oversample") {
+    Oversampler sampler;
+    Status stat = sampler.init(value);
+    if (!stat)
+      return Status::error(msg_prefix + "value '" + value + "': " +
+                           stat.msg());
+    oversample = value;
+  }
+  else if (setting == "filter") {
+    ReadingFilter reading_filter;
+    Status stat = reading_filter.init(value);
+    if (!stat)
+      return Status::error(msg_prefix + stat.msg());
+    filter = value;
+  }
+  else if (setting == "enabled" || setting == "print_commands" ||
+           setting == "run_commands" || setting == "turn_before_run" ||
+           setting == "event_wakeup") {
+    if (value.size() != 1 || !strchr("01", value[0]))
+      return Status::error(msg_prefix + "must be one digit, 0 or 1");
+    int flag = (value[0] == '1');
+    if (setting == "enabled")
+      set_enabled(flag);
+    else if (setting == "print_commands")
+      set_print_commands(flag);
+    else if (setting == "run_commands")
+      set_run_commands(flag);
+    else if (setting == "event_wakeup")
+      event_wakeup = flag;
+    else
+      turn_before_run = flag;
+  }
+  else
+    return Status::error(msg_prefix + "unknown setting");
+
+  return Status::ok();
+}
+
+DialBands DialSettings::create_dial_bands() const
+{
+  DialBands dial_bands;
+  auto overlap_frac = get_overlap();
+  // Bands between a mark and the next mark
+  auto add_step_bands = [&](DialBands *step_bands, long prev_mark,
+                            long cur_mark) {
+    long mid_point = (prev_mark + cur_mark) / 2;
+    if (overlap_frac > 0) {
+      long overlap = (cur_mark - prev_mark) * overlap_frac;
+      step_bands->add_band(mid_point - overlap / 2, prev_mark, cur_mark);
+      step_bands->add_band(mid_point, cur_mark, prev_mark);
+      step_bands->add_band(mid_point + overlap / 2, cur_mark, cur_mark);
+    }
+    else
+      step_bands->add_band(mid_point, cur_mark, cur_mark);
+  };
+
+  if (get_num_marks() >= 2) {
+    long prev_mark = DialBands::unset;
+    auto add_mark = [&](long cur_mark) {
+      if (prev_mark == DialBands::unset) // cur_mark is first mark
+        dial_bands.add_band(cur_mark, cur_mark, cur_mark);
+      else
+        add_step_bands(&dial_bands, prev_mark, cur_mark);
+      prev_mark = cur_mark;
+    };
+
+    // The marks of a range are evenly spaced, so the bands between each
+    // mark and the next are the same, from the mark below
+    auto cmd = commands.begin();
+    auto range = ranges.begin();
+    while (cmd != commands.end() || range != ranges.end()) {
+      if (range == ranges.end() ||
+          (cmd != commands.end() && cmd->first < range->start)) {
+        add_mark(cmd->first);
+        ++cmd;
+        continue;
+      }
+      add_mark(range->start);
+      if (range->count > 1) {
+        // the bands of the first step are also added, in case they replace
+        // the band of the first mark
+        add_step_bands(&dial_bands, range->start, range->mark(1));
+        DialBands step_bands;
+        add_step_bands(&step_bands, 0, range->step);
+        dial_bands.add_run(range->start, range->step, range->count - 1,
+                           step_bands.get_bands());
+        prev_mark = range->last();
+        // the last band of the run extends to the next band
+        dial_bands.add_band(prev_mark, prev_mark, prev_mark);
+      }
+      ++range;
+    }
+
+    dial_bands.add_band(prev_mark, prev_mark, prev_mark);
+  }
+
+  dial_bands.compile();
+  return dial_bands;
+};
+
+bool DialBands::in_select_zone(long kval, long mark) const
+{
+  // The select zone is made of the bands that select the mark, whatever
+  // the current mark
+  if (bands.empty())
+    return false;
+  const auto vals = band_at(kval);
+  return vals.first == mark && vals.second == mark;
+}
+
+void DialBands::set_compiled(const BuiltinChannel &chan)
+{
+  bands.clear();
+  keys.clear();
+  vals.clear();
+  for (int i = 0; i < chan.num_bands; i++) {
+    const auto &band = chan.bands[i];
+    bands[band.start] = {band.select, band.stay};
+    keys.push_back(band.start);
+    vals.push_back({band.select, band.stay});
+  }
+  table.assign(chan.table, chan.table + chan.table_size);
+  table_base = chan.table_base;
+  table_shift = chan.table_shift;
+}
+
+namespace {
+// Join items into lines of an initializer list, no more than 80 columns
+string cpp_list(const vector<string> &items)
+{
+  string list;
+  string line = " ";
+  for (const auto &item : items) {
+    if (line.size() + item.size() + 2 > 80) {
+      list += line + "\n";
+      line = " ";
+    }
+    line += " " + item + ",";
+  }
+  return list + line + "\n";
+}
+
+// Quote a string as a C++ string literal
+string cpp_string(const string &str)
+{
+  string quoted = "\"";
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\' || c == '?') // '?' could start a trigraph
+      quoted += string("\\") + char(c);
+    else if (c < ' ' || c > '~')
+      quoted += msg_str("\\%03o", c);
+    else
+      quoted += char(c);
+  }
+  return quoted + "\"";
+}
+
+// Write a long, so that the minimum value is a valid literal
+string cpp_long(long val)
+{
+  return (val == DialBands::unset) ? "builtin_unset" : msg_str("%ldL", val);
+}
+}; // namespace
+
+std::string DialBands::cpp_tables(const string &prefix, string *fields) const
+{
+  string defs;
+  vector<string> items;
+  for (const auto &kp : bands)
+    items.push_back(msg_str("{%s, %s, %s}", cpp_long(kp.first).c_str(),
+                            cpp_long(kp.second.first).c_str(),
+                            cpp_long(kp.second.second).c_str()));
+  if (!items.empty())
+    defs += "constexpr BuiltinBand " + prefix + "_bands[] = {\n" +
+            cpp_list(items) + "};\n";
+
+  items.clear();
+  for (auto band : table)
+    items.push_back(std::to_string(band));
+  if (!items.empty())
+    defs += "constexpr uint16_t " + prefix + "_table[] = {\n" +
+            cpp_list(items) + "};\n";
+
+  *fields = msg_str(
+      "    %s, %d, // bands\n"
+      "    %s, %d, %s, %d, // lookup table\n",
+      bands.empty() ? "nullptr" : (prefix + "_bands").c_str(),
+      int(bands.size()),
+      table.empty() ? "nullptr" : (prefix + "_table").c_str(),
+      int(table.size()), cpp_long(table_base).c_str(), table_shift);
+  return defs;
+}
+
+std::string DialSettings::dial_bands_report(const DialBands &dial_bands) const
+{
+  // The bands of ranges are shown for each mark
+  if (!ranges.empty()) {
+    const auto marks = expanded();
+    return marks.dial_bands_report(marks.create_dial_bands());
+  }
+
+  string str;
+  const auto &bands = dial_bands.get_bands();
+
+  const char *tab = "        ";
+  if (bands.size() < 2)
+    str = "  no command bands (need at least two commands)\n";
+  else {
+    vector<long> vals = {0L, 0L};
+    auto cmd = commands.begin();
+    for (auto band : bands) {
+      vals.push_back(band.first);
+      // str += msg_str("< %7ld | %7ld | %7ld >\n", band->first,
+      //               band->second.first, band->second.second);
+      if (vals.size() == 3) {
+        if (vals[0] == 0)
+          str += msg_str("%s<%6ld | <%6ld | <%6ld\n", tab, 0L, 0L, 0L);
+        else
+          str += msg_str("%s %6ld |  %6ld |  %6ld\n", tab, vals[0], vals[1],
+                         vals[2]);
+        str += msg_str("  %6ld: %s: %s\n", cmd->first,
+                       cmd->second.label.c_str(), cmd->second.command.c_str());
+        cmd = std::next(cmd);
+        vals.clear();
+      }
+    }
+    str += msg_str("%s>%6ld | >%6ld | >%6ld\n", tab, vals[0], vals[0], vals[0]);
+  }
+
+  return str;
+}
+
+std::string DialSettings::settings_report() const
+{
+  string str;
+  str += msg_str("  enabled = %d\n", enabled);
+  str += msg_str("  input = %s\n", input.c_str());
+  str += msg_str("  oversample = %s\n", oversample.c_str());
+  str += msg_str("  filter = %s\n", filter.c_str());
+  str += msg_str("  turn_before_run = %d\n", turn_before_run);
+  str += msg_str("  command_delay = %g\n", command_delay);
+  str += msg_str("  settle_mode = %s\n", settle_mode_name(settle_mode));
+  str += msg_str("  settle_velocity = %g\n", settle_velocity);
+  str += msg_str("  settle_window = %d\n", settle_window);
+  str += msg_str("  settle_noise = %g\n", settle_noise);
+  str += msg_str("  overlap = %g\n", overlap * 100); // convert to %
+  str += msg_str("  frequency = %g\n", frequency);
+  str += msg_str("  frequency_idle = %g\n", frequency_idle);
+  str += msg_str("  event_wakeup = %d\n", event_wakeup);
+  str += msg_str("  idle_delay = %g\n", idle_delay);
+  str += msg_str("  run_commands = %d\n", run_commands);
+  str += msg_str("  print_commands = %d\n", print_commands);
+  str += "\n";
+  if (commands.size() || ranges.size()) {
+    for (auto kp : commands)
+      str += msg_str("  %7ld = %s, %s\n", kp.first, kp.second.label.c_str(),
+                     kp.second.command.c_str());
+    for (const auto &range : ranges)
+      str += msg_str("  %7ld..%ld step %ld values %ld..%ld = %s, %s\n",
+                     range.start, range.last(), range.step, range.value_first,
+                     range.value_last, range.label.c_str(),
+                     range.command.c_str());
+    str += "\n";
+  }
+
+  return str;
+}
+
+void DialSettings::set_builtin(const BuiltinChannel &chan)
+{
+  enabled = true;
+  input = chan.input;
+  oversample = chan.oversample;
+  filter = chan.filter;
+  turn_before_run = chan.turn_before_run;
+  command_delay = chan.command_delay;
+  find_settle_mode(chan.settle_mode, &settle_mode); // already checked
+  settle_velocity = chan.settle_velocity;
+  settle_window = chan.settle_window;
+  settle_noise = chan.settle_noise;
+  overlap = chan.overlap;
+  frequency = chan.frequency;
+  frequency_idle = chan.frequency_idle;
+  event_wakeup = chan.event_wakeup;
+  idle_delay = chan.idle_delay;
+  run_commands = run_commands && chan.run_commands;
+  print_commands = print_commands || chan.print_commands;
+  commands.clear();
+  for (int i = 0; i < chan.num_commands; i++)
+    commands[chan.commands[i].mark] = {chan.commands[i].label,
+                                       chan.commands[i].command};
+}
+
+void Dial::set_tracing(bool flag)
+{
+  tracing = flag;
+  if (!tracing) {
+    runner.set_on_finish(nullptr);
+    return;
+  }
+
+  runner.set_on_finish([this](const CommandRunner::Times &times) {
+    Counter from_submit, from_spawn, from_turn;
+    from_submit.reset(times.submit);
+    from_spawn.reset(times.spawn);
+    from_turn.reset(times.turn);
+    add_trace(StageTrace::spawn, from_submit.usecs(times.spawn));
+    add_trace(StageTrace::run, from_spawn.usecs(times.exit));
+    add_trace(StageTrace::total, from_turn.usecs(times.spawn));
+  });
+}
+
+Status Dial::read_input(long long *raw_val, timeval *sample_time,
+                        bool *has_read)
+{
+  Counter read_time;
+  Status stat;
+  do {
+    if (has_read) {
+      if (!(stat = input->read_no_wait(raw_val, sample_time, has_read)) ||
+          !*has_read)
+        return stat;
+    }
+    else if (!(stat = input->read(raw_val, sample_time)))
+      return stat;
+  } while (!oversample(raw_val));
+
+  if (tracing)
+    add_trace(StageTrace::read, read_time.usecs());
+  return stat;
+}
+
+bool Dial::oversample(long long *raw_val)
+{
+  if (!oversampler.is_set())
+    return true;
+  if (!oversampler.add(*raw_val))
+    return false;
+  *raw_val = oversampler.reduce();
+  return true;
+}
+
+void Dial::load_program()
+{
+  // The generation is read first, so a program published while this
+  // loads is loaded again for the next reading
+  prog_gen = program_gen.load(std::memory_order_acquire);
+  auto old_prog = prog;
+  prog = get_program();
+  const auto &set = prog->get_settings();
+  if (!old_prog || old_prog->get_settings().get_filter() != set.get_filter())
+    filter.init(set.get_filter()); // already checked
+  if (!old_prog ||
+      old_prog->get_settings().get_oversample() != set.get_oversample())
+    oversampler.init(set.get_oversample());
+  if (!old_prog ||
+      old_prog->get_settings().get_settle_window() != set.get_settle_window()) {
+    settle_stats.set_window(set.get_settle_window());
+    diff_stats.set_window(set.get_settle_window());
+    velocity.set_window(set.get_settle_window());
+  }
+}
+
+void Dial::start_processing(bool wait)
+{
+  prog.reset();
+  load_program();
+  mark_last = DialBands::unset;
+  first_reading = true;
+  wait_for_commands = wait;
+  wait_for_turn = prog->get_settings().get_turn_before_run();
+  still.reset();
+  velocity.reset();
+  speed = 0;
+  peak_speed = 0;
+  cur = DialState();
+  publish_state();
+
+  // check whether to execute current command on start, or wait for dial change
+  // (by setting a long intial delay on the same band before running command)
+  const auto &set = prog->get_settings();
+  double initial_delay = (set.get_turn_before_run())
+                             ? 10000000                  // long time
+                             : set.get_command_delay(); // usual time
+  timer.set_timer(initial_delay);
+}
+
+Status Dial::process_raw(long long raw_val, const timeval *sample_time)
+{
+  Status stat;
+
+  timeval now;
+  if (sample_time)
+    now = *sample_time;
+  else
+    get_monotonic_time(&now);
+
+  if (program_gen.load(std::memory_order_acquire) != prog_gen)
+    load_program(); // new settings
+
+  // The unfiltered reading is recorded, so a replay can try other filters
+  if (recorder != nullptr && !(stat = recorder->write(record_channel, raw_val,
+                                                      now)))
+    return stat;
+  cur.sample++;
+  cur.time = now;
+  cur.raw = raw_val;
+  if (filter.is_set())
+    raw_val = filter.apply(raw_val, now);
+  cur.value = raw_val;
+
+  // The velocity is fitted to the last readings, which averages out the
+  // noise of single readings, and the highest speed since the mark
+  // changed is kept to tell whether the dial has slowed down
+  const auto mode = prog->get_settings().get_settle_mode();
+  if (mode == DialSettings::SettleMode::predict) {
+    if (first_reading)
+      since_first.reset(now);
+    const double secs = since_first.usecs(now) * 1e-6;
+    velocity.add(secs, raw_val);
+    speed = std::abs(velocity.slope());
+    if (speed >= peak_speed) {
+      peak_speed = speed;
+      peak_secs = secs;
+    }
+  }
+
+  // The dial is still while the variance of the last readings is close
+  // to the variance at rest. That is calibrated from the first readings,
+  // and then whenever the dial has been idle, from the differences between
+  // readings, which have twice the noise variance and do not vary with a
+  // steady turn.
+  if (mode == DialSettings::SettleMode::variance) {
+    if (!first_reading)
+      diff_stats.add(raw_val - raw_last);
+    settle_stats.add(raw_val);
+    const auto &set = prog->get_settings();
+    if (diff_stats.is_full() && set.get_settle_noise() == 0 &&
+        (cur.noise_var < 0 || still.secs() >= set.get_idle_delay())) {
+      const double var = diff_stats.variance() / 2;
+      cur.noise_var = (cur.noise_var < 0)
+                          ? var
+                          : cur.noise_var + 0.05 * (var - cur.noise_var);
+    }
+  }
+  raw_last = raw_val;
+  raw_last_time = now;
+
+  // mark for current raw value
+  auto mark_now = prog->get_bands().get_mark(raw_val, mark_last);
+  if (first_reading) {
+    mark_last = mark_now; // initially no change
+    first_reading = false;
+    turn_time = now;
+  }
+
+  // If current mark has changed then restart the timer
+  if (mark_now != mark_last) {
+    timer.set_timer(prog->get_settings().get_command_delay(), now);
+    still.reset();
+    wait_for_turn = false;
+    peak_speed = speed;
+    peak_secs = since_first.usecs(now) * 1e-6;
+    if (tracing) {
+      Counter since_sample;
+      since_sample.reset(now);
+      add_trace(StageTrace::mark, since_sample.usecs());
+      turn_time = now;
+    }
+  }
+  mark_last = mark_now;
+  cur.mark = mark_last;
+
+  stat = settle(now);
+  publish_state();
+  return stat;
+}
+
+Status Dial::settle(const timeval &now)
+{
+  Status stat;
+
+  // check if the dial...
+  //    has been in the current band for the delay time, or has stopped
+  //      in the select zone of its mark (settle_mode predict), AND
+  //    is no longer in the last stop band, AND
+  //    the reading is set
+  if (!first_reading && (timer.finished(now) || has_stopped()) &&
+      mark_last != cur.mark_stop && mark_last != DialBands::unset) {
+    // dial has stopped in a new band
+    cur.mark_stop = mark_last;
+    publish_state(); // before the command, which may take a while
+    DialSettings::Command cmd;
+    prog->get_command(mark_last, &cmd);
+
+    if (prog->get_settings().get_print_commands()) {
+      printf("\nCOMMAND (mark: %-10ld) %s: %s\n", mark_last,
+             cmd.label.c_str(), cmd.command.c_str());
+      fflush(stdout);
+    }
+
+    if (tracing)
+      add_trace(StageTrace::settle, still.usecs());
+
+    if (prog->get_settings().get_run_commands())
+      stat = (wait_for_commands) ? runner.run(cmd.command, &turn_time)
+                                 : runner.submit(cmd.command, &turn_time);
+  }
+  else if (!wait_for_commands)
+    stat = runner.poll(); // start any queued command
+
+  return stat;
+}
+
+bool Dial::has_stopped() const
+{
+  if (wait_for_turn || !prog->get_bands().in_select_zone(raw_last, mark_last))
+    return false;
+
+  switch (prog->get_settings().get_settle_mode()) {
+  case DialSettings::SettleMode::predict: {
+    // The dial is stopping if it has slowed, since it reached the mark, to
+    // below the settle velocity and a quarter of its highest speed. A
+    // steady turn, however slow, keeps its speed, and a dial that has
+    // only slowed on the way to another mark would come to rest outside
+    // the select zone at its current deceleration.
+    if (!velocity.is_full() ||
+        speed >= prog->get_settings().get_settle_velocity() ||
+        speed > peak_speed / 4)
+      return false;
+    double dist = 0; // distance to come to rest
+    if (speed > 0) {
+      const double decel_secs = since_first.usecs(raw_last_time) * 1e-6 -
+                                peak_secs;
+      const double decel = (peak_speed - speed) / decel_secs;
+      dist = std::copysign(speed * speed / (2 * decel), velocity.slope());
+    }
+    return prog->get_bands().in_select_zone(std::lround(raw_last + dist),
+                                            mark_last);
+  }
+
+  case DialSettings::SettleMode::variance: {
+    // The readings vary no more than the noise, with at least a unit of
+    // noise, as the readings are whole numbers
+    if (!settle_stats.is_full())
+      return false;
+    const double set_noise = prog->get_settings().get_settle_noise();
+    const double noise = std::max(
+        1.0, (set_noise > 0) ? set_noise
+                             : std::sqrt(std::max(0.0, cur.noise_var)));
+    return std::sqrt(settle_stats.variance()) <= 2 * noise &&
+           settle_stats.range() <= 6 * noise;
+  }
+
+  default: // only stopped when the command delay has passed
+    return false;
+  }
+}
+
+double Dial::get_noise_floor() const
+{
+  const double set_noise = get_program()->get_settings().get_settle_noise();
+  if (set_noise > 0)
+    return set_noise;
+  const auto var = get_state().noise_var;
+  return (var < 0) ? -1 : std::sqrt(var);
+}
+
+Status Dial::poll_commands()
+{
+  return wait_for_commands ? Status::ok() : runner.poll();
+}
+
+bool Dial::get_settle_time(timeval *settle_time) const
+{
+  if (first_reading || wait_for_turn || mark_last == DialBands::unset ||
+      mark_last == cur.mark_stop)
+    return false;
+  *settle_time = timer.get_end();
+  return true;
+}
+
+double Dial::get_pending_secs() const
+{
+  timeval settle_time;
+  return get_settle_time(&settle_time) ? timer.remaining() : -1;
+}
+
+double Dial::get_reading_frequency() const
+{
+  // Idle once any command has run and the dial has stayed still, until
+  // the reading leaves the stay range of the mark and the mark changes
+  const double idle_freq = prog->get_settings().get_frequency_idle();
+  if (idle_freq > 0 && get_pending_secs() < 0 &&
+      still.secs() >= prog->get_settings().get_idle_delay())
+    return std::min(idle_freq, prog->get_settings().get_frequency());
+  return prog->get_settings().get_frequency();
+}
+
+Status Ads1x15::use_i2c(int bus, int address, const std::string &chip_name,
+                        int data_rate)
+{
+  i2c = std::make_unique<Ads1x15I2c>();
+  Status stat = i2c->open(bus, address, chip_name, data_rate);
+  if (!stat)
+    i2c.reset();
+  return stat;
+}
+
+Status Ads1x15::init(const DialSettings &default_settings, int num_channels)
+{
+  dials.clear();
+  for (int i = 0; i < num_channels; i++) {
+    dials.push_back(std::make_unique<Dial>());
+    *dials.back()->get_settings() = default_settings;
+    dials.back()->compile_program();
+  }
+  return Status::ok();
+};
+
+Ads1x15::~Ads1x15()
+{
+  iio_adcs.clear();
+  if (context != nullptr)
+    iio_context_destroy(context);
+}
+
+Status Ads1x15::find_iio_adc(const std::string &name, IioAdc **adc)
+{
+  // All IIO devices share one context, created when first needed
+  if (context == nullptr) {
+    context = iio_create_local_context();
+    if (context == nullptr)
+      return Status::error("could not create IIO context");
+  }
+
+  auto device = iio_context_find_device(context, name.c_str());
+  if (device == nullptr)
+    return Status::error("could not find IIO device '" + name + "'");
+
+  for (auto &iio_adc : iio_adcs)
+    if (iio_adc->get_device() == device) {
+      *adc = iio_adc.get();
+      return Status::ok();
+    }
+
+  iio_adcs.push_back(std::make_unique<IioAdc>(device));
+  *adc = iio_adcs.back().get();
+  return Status::ok();
+}
+
+Status Ads1x15::open_inputs()
+{
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    auto dial = dials[idx].get();
+    const auto settings = dial->get_settings();
+    if (!settings->is_enabled())
+      continue;
+
+    Status stat;
+    const string msg_prefix =
+        msg_str("channel '%c': input: ", channel_idx_to_char(idx));
+    auto words = split_words(settings->get_input());
+    if (settings->is_adc_input() && idx >= num_adc_channels)
+      return Status::error(msg_prefix + "adc is only available for channels "
+                                        "a - d, use 'iio device channel'");
+    else if (settings->is_adc_input() && i2c)
+      dial->set_input(std::make_unique<I2cInput>(i2c.get(), idx));
+    else if (settings->is_adc_input() || words[0] == "iio") {
+      string name = "ads1015";
+      int chan = idx;
+      if (words[0] == "iio") {
+        name = words[1];
+        read_int(words[2].c_str(), &chan);
+      }
+      IioAdc *adc;
+      if (!(stat = find_iio_adc(name, &adc)) ||
+          !(stat = adc->open_channel(chan)))
+        return Status::error(msg_prefix + stat.msg());
+      dial->set_input(std::make_unique<IioInput>(adc, chan));
+    }
+    else {
+      // A simulated input in free run makes readings a burst apart
+      Oversampler sampler;
+      sampler.init(settings->get_oversample());
+      std::unique_ptr<InputSource> input;
+      if (!(stat = make_input(settings->get_input(), idx,
+                              settings->get_frequency() *
+                                  sampler.get_num_samples(),
+                              free_run, &input)))
+        return Status::error(msg_prefix + stat.msg());
+      dial->set_input(std::move(input));
+    }
+  }
+
+  return Status::ok();
+}
+
+Status Ads1x15::record_to(const std::string &file_name)
+{
+  recorder = std::make_unique<Recorder>();
+  Status stat = recorder->open(file_name);
+  if (!stat) {
+    recorder.reset();
+    return stat;
+  }
+
+  for (size_t idx = 0; idx < dials.size(); idx++)
+    dials[idx]->set_recorder(recorder.get(), idx);
+  return Status::ok();
+}
+
+std::string Ads1x15::config_report() const
+{
+  string report;
+  if (i2c || !iio_adcs.empty()) {
+    report += "\n== ADC ==\n\n";
+    if (i2c)
+      report += "  " + i2c->get_description() + "\n";
+    for (const auto &iio_adc : iio_adcs)
+      report += "  IIO device " + iio_adc->get_description() + "\n";
+  }
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    const auto settings = dials[idx]->get_settings();
+    if (!settings->is_enabled())
+      continue; // Don't report disabled channels
+
+    report += msg_str("\n== CHANNEL %c ==\n\n", channel_idx_to_char(idx));
+    report += dials[idx]->get_program()->report();
+  }
+
+  return report;
+}
+
+std::string Ads1x15::schedule_report() const
+{
+  string report = "\n== Reading Schedule ==\n\n";
+  const double hours = run_time.secs() / 3600;
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    if (!dials[idx]->get_settings()->is_enabled())
+      continue;
+
+    report += msg_str("  channel %c: ", channel_idx_to_char(idx));
+    const auto stats = dials[idx]->get_tick_stats();
+    if (stats.ticks == 0) {
+      report += "not read on a schedule\n";
+      continue;
+    }
+    report += msg_str("%g/s schedule, %ld ticks (%.0f/hour), %ld overruns "
+                      "(%ld ticks skipped), late mean %.3f ms, max %.3f ms\n",
+                      1 / stats.period, stats.ticks, stats.ticks / hours,
+                      stats.overruns, stats.missed,
+                      1000 * stats.late_sum / stats.ticks,
+                      1000 * stats.late_max);
+    if (dials[idx]->get_settings()->get_settle_mode() ==
+        DialSettings::SettleMode::variance)
+      report += msg_str("    noise floor: %.2f (standard deviation)\n",
+                        dials[idx]->get_noise_floor());
+  }
+
+  report += "  scheduling: " +
+            (realtime_desc.empty() ? string("normal") : realtime_desc) + "\n";
+
+  // CPU time for the whole process, including commands that have finished
+  rusage self, children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  auto to_secs = [](const timeval &tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+  const double self_cpu = to_secs(self.ru_utime) + to_secs(self.ru_stime);
+  const double child_cpu =
+      to_secs(children.ru_utime) + to_secs(children.ru_stime);
+  report += msg_str("  CPU: %.3f s/hour (commands %.3f s/hour), "
+                    "%.0f context switches/hour, over %.0f s\n",
+                    self_cpu / hours, child_cpu / hours,
+                    (self.ru_nvcsw + self.ru_nivcsw) / hours, hours * 3600);
+
+  return report;
+}
+
+Status Ads1x15::set_realtime(int priority, bool lock_memory,
+                             const vector<int> &cpus)
+{
+  vector<string> descs;
+  if (!cpus.empty()) {
+    cpu_set_t cpu_set;
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+      CommandRunner::set_command_cpus(cpu_set);
+
+    CPU_ZERO(&cpu_set);
+    vector<string> cpu_strs;
+    for (int cpu : cpus) {
+      CPU_SET(cpu, &cpu_set);
+      cpu_strs.push_back(std::to_string(cpu));
+    }
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                     &cpu_set);
+    if (err)
+      return Status::error(
+          msg_str("could not set CPU affinity: %s", strerror(err)));
+    descs.push_back("CPUs " + join(cpu_strs.begin(), cpu_strs.end(), ","));
+  }
+
+  if (priority > 0) {
+    sched_param param = {};
+    param.sched_priority = priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err)
+      return Status::error(msg_str(
+          "could not set SCHED_FIFO priority %d: %s", priority, strerror(err)));
+    descs.push_back(msg_str("SCHED_FIFO priority %d", priority));
+  }
+
+  if (lock_memory) {
+    // Pages are locked as they are used, so that the unused parts of
+    // thread stacks do not take up RAM
+    int flags = MCL_CURRENT | MCL_FUTURE;
+#ifdef MCL_ONFAULT
+    flags |= MCL_ONFAULT;
+#endif
+    if (mlockall(flags) != 0)
+      return Status::error(
+          msg_str("could not lock memory: %s", strerror(errno)));
+    descs.push_back("memory locked");
+  }
+
+  realtime_desc = join(descs.begin(), descs.end(), ", ");
+  return Status::ok();
+}
+
+void Ads1x15::set_tracing(bool flag)
+{
+  for (auto &dial : dials)
+    dial->set_tracing(flag);
+}
+
+std::string Ads1x15::trace_report() const
+{
+  string report = "\n== Command Latency ==\n";
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    if (!dials[idx]->get_settings()->is_enabled())
+      continue;
+    report += msg_str("\n  channel %c:\n", channel_idx_to_char(idx));
+    report += dials[idx]->get_stage_trace().report("    ");
+  }
+  return report;
+}
+
+void Ads1x15::flush_recording()
+{
+  if (recorder)
+    recorder->flush();
+}
+
+namespace {
+// Check that a lookup gives the same marks as the map of bands, for every
+// reading in the range of the bands and beyond, when turning the dial up
+// and down from each mark and from no mark
+template <typename Lookup>
+long lookup_mismatches(const DialBands &bands, Lookup lookup, long *checks)
+{
+  const auto &band_map = bands.get_bands();
+  if (band_map.empty())
+    return 0;
+  const long margin = 1000;
+  const long low = band_map.begin()->first - margin;
+  const long high = band_map.rbegin()->first + margin;
+  vector<long> start_marks = {DialBands::unset};
+  for (const auto &kp : band_map)
+    start_marks.push_back(kp.second.first);
+
+  long mismatches = 0;
+  *checks = 0;
+  for (auto start_mark : start_marks) {
+    for (int dir : {1, -1}) {
+      long mark = start_mark;
+      for (long kval = (dir > 0) ? low : high; kval >= low && kval <= high;
+           kval += dir) {
+        const long by_map = bands.get_mark_by_map(kval, mark);
+        mismatches += (lookup(kval, mark) != by_map);
+        mark = by_map;
+        (*checks)++;
+      }
+    }
+  }
+  return mismatches;
+}
+
+// Check that the lookup table gives the same marks as the map
+long band_lookup_mismatches(const DialBands &bands, long *checks)
+{
+  return lookup_mismatches(
+      bands, [&](long kval, long mark) { return bands.get_mark(kval, mark); },
+      checks);
+}
+
+// Check that the builtin bands, searched as at compile time, give the same
+// marks as bands compiled from the builtin settings
+long builtin_mismatches(const BuiltinChannel &chan, const DialBands &bands,
+                        long *checks)
+{
+  return lookup_mismatches(
+      bands,
+      [&](long kval, long mark) { return builtin_get_mark(chan, kval, mark); },
+      checks);
+}
+
+// Check that the bands of ranges of marks give the same marks, stay
+// ranges and commands as bands made with a command for each mark
+long range_mismatches(const ChannelProgram &prog, long *checks)
+{
+  const auto &bands = prog.get_bands();
+  const auto marks = prog.get_settings().expanded();
+  const auto mark_bands = marks.create_dial_bands();
+  long mismatches = lookup_mismatches(
+      mark_bands,
+      [&](long kval, long mark) { return bands.get_mark(kval, mark); },
+      checks);
+  for (const auto &kp : marks.get_commands()) {
+    long low, high, mark_low, mark_high;
+    const bool found = bands.get_mark_range(kp.first, &low, &high);
+    mismatches +=
+        (found != mark_bands.get_mark_range(kp.first, &mark_low, &mark_high) ||
+         low != mark_low || high != mark_high);
+    for (long kval : {kp.first - 1, kp.first, kp.first + 1})
+      mismatches += (bands.in_select_zone(kval, kp.first) !=
+                     mark_bands.in_select_zone(kval, kp.first));
+    DialSettings::Command cmd;
+    mismatches += (!prog.get_command(kp.first, &cmd) ||
+                   cmd.label != kp.second.label ||
+                   cmd.command != kp.second.command);
+    *checks += 5;
+  }
+  return mismatches;
+}
+
+// Time finding marks for random readings with the map and lookup table,
+// for dials with different numbers of evenly spaced marks
+string band_lookup_benchmark(int num_reads)
+{
+  string report;
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<long> dist(-1000, 27000);
+  vector<long> readings(4096);
+  for (auto &kval : readings)
+    kval = dist(gen);
+
+  long total = 0; // use the results, so they are not optimised out
+  for (int num_marks : {2, 10, 100, 1000}) {
+    DialSettings settings;
+    for (int i = 0; i < num_marks; i++)
+      settings.set_command(i * 26000 / (num_marks - 1), "mark", "true");
+    const auto bands = settings.create_dial_bands();
+
+    long mark = DialBands::unset;
+    Counter counter;
+    for (int i = 0; i < num_reads; i++)
+      total += (mark = bands.get_mark_by_map(readings[i & 4095], mark));
+    const double map_usecs = counter.usecs();
+
+    mark = DialBands::unset;
+    counter.reset();
+    for (int i = 0; i < num_reads; i++)
+      total += (mark = bands.get_mark(readings[i & 4095], mark));
+    const double table_usecs = counter.usecs();
+
+    report += msg_str("  %4d marks: map %8.1f ns/reading, table %8.1f "
+                      "ns/reading\n",
+                      num_marks, 1000 * map_usecs / num_reads,
+                      1000 * table_usecs / num_reads);
+  }
+
+  // The same marks as a range, which are found arithmetically
+  DialSettings settings;
+  settings.set_command_range("0..26000 step 26", "mark_{i}", "true");
+  const auto bands = settings.create_dial_bands();
+  long mark = DialBands::unset;
+  Counter counter;
+  for (int i = 0; i < num_reads; i++)
+    total += (mark = bands.get_mark(readings[i & 4095], mark));
+  const double range_usecs = counter.usecs();
+  report += msg_str("  %4ld marks: range %8.1f ns/reading (a range of marks)\n",
+                    settings.get_num_marks(), 1000 * range_usecs / num_reads);
+  return (total == 0) ? report + "  (all marks were zero)\n" : report;
+}
+
+// Publish states from one thread while reading them in this thread, and
+// check that every state read was stored whole. The fields of each state
+// are all set from the sample number.
+string dial_state_check(int num_stores)
+{
+  SeqLock<DialState> state;
+  std::atomic<bool> reading{false};
+  std::atomic<bool> done{false};
+  double store_usecs = 0;
+  std::thread writer([&] {
+    while (!reading)
+      ; // start storing when loads are under way
+    DialState cur;
+    Counter counter;
+    for (int i = 1; i <= num_stores; i++) {
+      cur.sample = i;
+      cur.time.tv_sec = i;
+      cur.time.tv_usec = i % 1000000;
+      cur.raw = cur.value = cur.mark = cur.mark_stop = i;
+      cur.noise_var = i;
+      state.store(cur);
+    }
+    store_usecs = counter.usecs();
+    done = true;
+  });
+
+  long loads = 0;
+  long torn = 0;
+  uint64_t last_sample = 0;
+  long backwards = 0;
+  Counter counter;
+  reading = true;
+  while (!done) {
+    const auto cur = state.load();
+    loads++;
+    const long long i = cur.sample;
+    if (i == 0)
+      continue; // nothing stored yet
+    torn += (cur.time.tv_sec != i || cur.time.tv_usec != i % 1000000 ||
+             cur.raw != i || cur.value != i || cur.mark != i ||
+             cur.mark_stop != i || cur.noise_var != i);
+    backwards += (cur.sample < last_sample);
+    last_sample = cur.sample;
+  }
+  const double load_usecs = counter.usecs();
+  writer.join();
+
+  return msg_str("  %d states stored, %.1f ns/store, while %ld loaded, "
+                 "%.1f ns/load\n"
+                 "  states loaded %s (%ld torn, %ld out of order)\n",
+                 num_stores, 1000 * store_usecs / num_stores, loads,
+                 loads ? 1000 * load_usecs / loads : 0.0,
+                 (torn || backwards) ? "INCONSISTENT" : "consistent", torn,
+                 backwards);
+}
+}; // namespace
+
+std::string Ads1x15::benchmark_report(int num_reads)
+{
+  string report = "\n== Read Benchmark ==\n\n";
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    const auto settings = dials[idx]->get_settings();
+    auto input = dials[idx]->get_input();
+    auto iio_input = dynamic_cast<IioInput *>(input);
+    auto i2c_input = dynamic_cast<I2cInput *>(input);
+    if (!settings->is_enabled() || (!iio_input && !i2c_input))
+      continue; // Only benchmark enabled ADC channels
+
+    report += msg_str("  channel %c (%d reads): %s\n", channel_idx_to_char(idx),
+                      num_reads, input->get_description().c_str());
+    long long raw;
+    timeval sample_time;
+    Counter counter;
+    if (i2c_input) {
+      for (int i = 0; i < num_reads; i++)
+        if (!input->read(&raw, &sample_time))
+          return report + "    i2c-dev read failed\n";
+      report += msg_str("    i2c-dev register: %10.1f us/read\n",
+                        counter.usecs() / double(num_reads));
+      continue;
+    }
+
+    auto adc = iio_input->get_adc();
+    const int chan = iio_input->get_channel();
+    counter.reset();
+    for (int i = 0; i < num_reads; i++)
+      if (!adc->read_raw_attr(chan, &raw))
+        return report + "    libiio attribute read failed\n";
+    report += msg_str("    libiio attribute: %10.1f us/read\n",
+                      counter.usecs() / double(num_reads));
+
+    if (!adc->has_raw_file(chan)) {
+      report += "    persistent pread: sysfs file not open\n";
+      continue;
+    }
+    counter.reset();
+    for (int i = 0; i < num_reads; i++)
+      if (!adc->read_raw(chan, &raw))
+        return report + "    persistent pread failed\n";
+    report += msg_str("    persistent pread: %10.1f us/read\n",
+                      counter.usecs() / double(num_reads));
+  }
+
+  // Time reducing bursts of noisy readings, for oversampled channels
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    const auto settings = dials[idx]->get_settings();
+    Oversampler sampler;
+    sampler.init(settings->get_oversample());
+    if (!settings->is_enabled() || !sampler.is_set())
+      continue;
+
+    const int num_bursts = 64;
+    std::mt19937 gen(idx);
+    std::uniform_int_distribution<int> noise(-500, 500);
+    vector<long long> bursts(num_bursts * sampler.get_num_samples());
+    for (auto &raw : bursts)
+      raw = 10000 + noise(gen);
+
+    long long total = 0; // use the results, so they are not optimised out
+    Counter counter;
+    const int burst_size = sampler.get_num_samples();
+    for (int i = 0; i < num_reads; i++) {
+      const long long *raw = &bursts[(i % num_bursts) * burst_size];
+      while (!sampler.add(*raw++))
+        ;
+      total += sampler.reduce();
+    }
+    report += msg_str("  channel %c (%d bursts): oversample = %s\n"
+                      "    reduce: %10.3f us/burst (mean reading %lld)\n",
+                      channel_idx_to_char(idx), num_reads,
+                      settings->get_oversample().c_str(),
+                      counter.usecs() / double(num_reads), total / num_reads);
+  }
+
+  report += "\n== Band Lookup ==\n\n";
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    if (!dials[idx]->get_settings()->is_enabled())
+      continue;
+    long checks = 0;
+    const long mismatches =
+        band_lookup_mismatches(dials[idx]->get_program()->get_bands(), &checks);
+    report += msg_str("  channel %c: lookup table and map %s (%ld readings "
+                      "checked, %ld mismatches)\n",
+                      channel_idx_to_char(idx), mismatches ? "DIFFER" : "agree",
+                      checks, mismatches);
+  }
+  report += "\n" + band_lookup_benchmark(num_reads);
+
+  string range_report;
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    const auto prog = dials[idx]->get_program();
+    const auto &settings = prog->get_settings();
+    if (!settings.is_enabled() || settings.get_command_ranges().empty())
+      continue;
+    long checks = 0;
+    const long mismatches = range_mismatches(*prog, &checks);
+    range_report += msg_str("  channel %c: range bands and bands for each mark "
+                            "%s (%ld checks, %ld mismatches)\n",
+                            channel_idx_to_char(idx),
+                            mismatches ? "DIFFER" : "agree", checks,
+                            mismatches);
+  }
+  if (!range_report.empty())
+    report += "\n== Ranges of Marks ==\n\n" + range_report;
+
+  if (has_builtin_config()) {
+    report += "\n== Builtin Configuration ==\n\n";
+    for (size_t idx = 0; idx < dials.size(); idx++) {
+      const auto builtin = dials[idx]->get_builtin();
+      if (!builtin)
+        continue;
+      long checks = 0;
+      const long mismatches = builtin_mismatches(
+          *builtin, dials[idx]->get_settings()->create_dial_bands(), &checks);
+      report += msg_str("  channel %c: builtin bands and settings %s (%ld "
+                        "readings checked, %ld mismatches)\n",
+                        channel_idx_to_char(idx),
+                        mismatches ? "DIFFER" : "agree", checks, mismatches);
+    }
+    report += "  configuration file: " + builtin_config_name() + "\n";
+  }
+
+  report += "\n== Published State ==\n\n";
+  report += dial_state_check(std::max(num_reads, 1000000));
+
+  return report;
+}
+
+Status Ads1x15::start_dial_loop(int idx)
+{
+  Status stat;
+
+  auto dial = dials[idx].get();
+  auto input = dial->get_input();
+  if (input == nullptr)
+    return Status::error(
+        msg_str("channel '%c': no input", channel_idx_to_char(idx)));
+
+  // Sleep until the reading leaves the current mark range, after the
+  // dial has been still long enough for any command to have run
+  auto iio_input = dynamic_cast<IioInput *>(input);
+  bool wakeup_failed = false; // event wakeup was disabled after an error
+  bool event_wakeup = false;
+  double idle_delay = 0;
+
+  // The loop settings are taken from the published program, and taken
+  // again when a new program is published
+  unsigned loop_gen = 0;
+  auto load_loop_settings = [&]() {
+    loop_gen = dial->get_program_generation();
+    const auto &set = dial->get_program()->get_settings();
+    event_wakeup = set.get_event_wakeup() && iio_input && !wakeup_failed;
+    idle_delay = std::max(set.get_idle_delay(), set.get_command_delay());
+  };
+
+  // Readings are made on a fixed schedule, whatever time is taken
+  // processing them, unless the input signals new readings
+  dial->start_processing();
+  load_loop_settings();
+  double frequency = dial->get_reading_frequency();
+  Ticker ticker(1 / frequency);
+
+  while (true) {
+    long long raw;
+    timeval sample_time;
+    if (!(stat = dial->read_input(&raw, &sample_time)))
+      return stat; // error, or warning at end of input
+
+    if ((stat = dial->process_raw(raw, &sample_time)).is_error())
+      return stat;
+    if (dial->get_program_generation() != loop_gen)
+      load_loop_settings();
+
+    long low, high;
+    if (event_wakeup && dial->get_still_secs() >= idle_delay &&
+        dial->get_stay_range(&low, &high)) {
+      if ((stat = iio_input->get_adc()->wait_for_event(
+               iio_input->get_channel(), low, high))
+              .is_ok()) {
+        ticker.restart();
+        continue; // read immediately after waking
+      }
+      fprintf(stderr, "warning: channel %c: event wakeup disabled: %s\n",
+              channel_idx_to_char(idx), stat.c_msg());
+      event_wakeup = false;
+      wakeup_failed = true;
+    }
+
+    if (free_run)
+      continue;
+    else if (input->is_event_driven()) {
+      // Wait for a new reading, or until a command is due to run
+      if (!(stat = input->wait(dial->get_pending_secs())))
+        return stat;
+    }
+    else {
+      // The schedule slows down while the dial is idle
+      if (dial->get_reading_frequency() != frequency) {
+        frequency = dial->get_reading_frequency();
+        ticker.set_period(1 / frequency);
+      }
+      // A command due before the next reading is run on time
+      timeval settle_time, next_tick = ticker.get_next_tick();
+      if (dial->get_settle_time(&settle_time) &&
+          timercmp(&settle_time, &next_tick, <)) {
+        sleep_until_time(settle_time);
+        if ((stat = dial->settle(settle_time)).is_error())
+          return stat;
+      }
+      ticker.sleep_until_next();
+      dial->set_tick_stats(ticker.get_stats());
+    }
+  }
+
+  return stat;
 }
 
-DialSettings::Command DialSettings::get_command(long dial_reading) const
+namespace {
+// Update a final status to the first occurence of the worst status
+void update_status(Status *stat, const Status &new_stat)
 {
-  auto it = commands.find(dial_reading);
-  return (it == commands.end()) ? Command() : it->second;
+  if ((stat->is_ok() && !new_stat.is_ok()) ||
+      (stat->is_warning() && new_stat.is_error()))
+    *stat = new_stat;
 }
+}; // namespace
 
-Status DialSettings::set_setting(std::string setting, std::string value)
+Status Ads1x15::run_groups(
+    const vector<vector<int>> &groups,
+    const std::function<Status(const vector<int> &)> &group_loop)
 {
-  if (setting.empty())
-    return Status::error("no setting given");
-
-  if (value.empty())
-    return Status::error("no value given");
-
-  string msg_prefix = "setting '" + setting + "': ";
-  if (setting == "overlap" || setting == "command_delay" ||
-      setting == "frequency") {
-    string msg_prefix2 = msg_prefix + "value '" + value + "': ";
-    double num;
-    Status stat = read_double(value.c_str(), &num);
-    if (!stat)
-      return Status::error(msg_prefix2 + "not a number: " + stat.msg());
-
-    int lim_low = (setting == "frequency") ? 1 : 0;
-    int lim_high = (setting == "command_delay") ? 10 : 50;
-    if (num < lim_low || num > lim_high)
-      return Status::error(msg_prefix2 + "must be in range " +
-                           std::to_string(lim_low) + " to " +
-                           std::to_string(lim_high));
+  // Each group of channels is processed in its own thread. The group
+  // loops only end when their inputs end, so an error in one group stops
+  // the others, which check stop_groups.
+  stop_groups = false;
+  vector<Status> group_stats(groups.size());
+  vector<std::thread> threads;
+  for (size_t i = 0; i < groups.size(); i++)
+    threads.push_back(std::thread([&, i] {
+      group_stats[i] = group_loop(groups[i]);
+      if (group_stats[i].is_error())
+        stop_groups = true;
+    }));
 
-    if (setting == "overlap")
-      overlap = num / 100;
-    else if (setting == "command_delay")
-      command_delay = num;
-    else // setting == frquency
-      frequency = num;
-  }
-  else if (setting == "enabled" || setting == "print_commands" ||
-           setting == "run_commands" || setting == "turn_before_run") {
-    if (value.size() != 1 || !strchr("01", value[0]))
-      return Status::error(msg_prefix + "must be one digit, 0 or 1");
-    int flag = (value[0] == '1');
-    if (setting == "enabled")
-      set_enabled(flag);
-    else if (setting == "print_commands")
-      set_print_commands(flag);
-    else if (setting == "run_commands")
-      set_run_commands(flag);
-    else
-      turn_before_run = flag;
+  Status stat;
+  for (size_t i = 0; i < groups.size(); i++) {
+    threads[i].join();
+    update_status(&stat, group_stats[i]);
   }
-  else
-    return Status::error(msg_prefix + "unknown setting");
 
-  return Status::ok();
+  return stat;
 }
 
-DialBands DialSettings::create_dial_bands() const
+Status Ads1x15::start_scan_loop()
 {
-  DialBands dial_bands;
-  auto overlap_frac = get_overlap();
-  if (get_commands().size() >= 2) {
-    long cur_mark;
-    long prev_mark = DialBands::unset;
-    for (auto kp : get_commands()) {
-      cur_mark = kp.first;
-      if (prev_mark == DialBands::unset) { // cur_mark is first mark
-        dial_bands.add_band(cur_mark, cur_mark, cur_mark);
-      }
-      else {
-        long mid_point = (prev_mark + cur_mark) / 2;
-        if (overlap_frac > 0) {
-          long overlap = (cur_mark - prev_mark) * overlap_frac;
-          dial_bands.add_band(mid_point - overlap / 2, prev_mark, cur_mark);
-          dial_bands.add_band(mid_point, cur_mark, prev_mark);
-          dial_bands.add_band(mid_point + overlap / 2, cur_mark, cur_mark);
-        }
-        else
-          dial_bands.add_band(mid_point, cur_mark, cur_mark);
-      }
-      prev_mark = cur_mark;
+  // Channels reading from the same device are scanned in turn by one
+  // thread, so that reads of different devices don't wait for each other
+  vector<vector<int>> groups;
+  std::map<const void *, size_t> device_groups;
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    if (!dials[idx]->get_settings()->is_enabled())
+      continue;
+    auto input = dials[idx]->get_input();
+    if (input == nullptr)
+      return Status::error(
+          msg_str("channel '%c': no input", channel_idx_to_char(idx)));
+    auto device = input->get_device();
+    if (device == nullptr) { // independent input, scanned on its own
+      groups.push_back({int(idx)});
+      continue;
     }
-
-    dial_bands.add_band(prev_mark, prev_mark, prev_mark);
+    auto it = device_groups.insert({device, groups.size()}).first;
+    if (it->second == groups.size())
+      groups.push_back({});
+    groups[it->second].push_back(idx);
   }
 
-  return dial_bands;
-};
+  return run_groups(groups,
+                    [this](const vector<int> &idxs) {
+                      return scan_channels(idxs);
+                    });
+}
 
-std::string DialSettings::dial_bands_report(const DialBands &dial_bands) const
+Status Ads1x15::scan_channels(const vector<int> &scan_idxs)
 {
-  string str;
-  const auto &bands = dial_bands.get_bands();
+  // Channels are read at their current reading frequency, which is lower
+  // for a channel that is idle, and 0 when the channel input has ended
+  vector<double> freqs(dials.size(), 0);
+  for (auto idx : scan_idxs) {
+    freqs[idx] = dials[idx]->get_settings()->get_frequency();
+    dials[idx]->start_processing(false); // commands run in the background
+  }
 
-  const char *tab = "        ";
-  if (bands.size() < 2)
-    str = "  no command bands (need at least two commands)\n";
-  else {
-    vector<long> vals = {0L, 0L};
-    auto cmd = commands.begin();
-    for (auto band : bands) {
-      vals.push_back(band.first);
-      // str += msg_str("< %7ld | %7ld | %7ld >\n", band->first,
-      //               band->second.first, band->second.second);
-      if (vals.size() == 3) {
-        if (vals[0] == 0)
-          str += msg_str("%s<%6ld | <%6ld | <%6ld\n", tab, 0L, 0L, 0L);
-        else
-          str += msg_str("%s %6ld |  %6ld |  %6ld\n", tab, vals[0], vals[1],
-                         vals[2]);
-        str += msg_str("  %6ld: %s: %s\n", cmd->first,
-                       cmd->second.label.c_str(), cmd->second.command.c_str());
-        cmd = std::next(cmd);
-        vals.clear();
+  // The scan ticks at the highest channel frequency, and each channel is
+  // read on every n'th tick, where n gives the nearest frequency to the
+  // channel frequency
+  double frequency = *std::max_element(freqs.begin(), freqs.end());
+  Ticker ticker(1 / frequency);
+  DeadlineQueue settles; // channels waiting to run a command
+  Status end_stat;       // status of input ending
+  for (long tick_no = 0; !stop_groups; tick_no++) {
+    for (auto idx : scan_idxs) {
+      if (freqs[idx] == 0 ||
+          tick_no % std::max(1L, std::lround(frequency / freqs[idx])))
+        continue;
+
+      Status stat;
+      long long raw;
+      timeval sample_time;
+      auto dial = dials[idx].get();
+      if ((stat = dial->read_input(&raw, &sample_time)).is_error())
+        return stat;
+      if (stat.is_warning()) { // end of input, stop scanning the channel
+        end_stat = stat;
+        freqs[idx] = 0;
+        settles.cancel(idx);
+        continue;
       }
+
+      if ((stat = dial->process_raw(raw, &sample_time)).is_error())
+        return stat;
+      freqs[idx] = dial->get_reading_frequency();
+      timeval settle_time;
+      if (dial->get_settle_time(&settle_time))
+        settles.set(idx, settle_time);
+      else
+        settles.cancel(idx);
     }
-    str += msg_str("%s>%6ld | >%6ld | >%6ld\n", tab, vals[0], vals[0], vals[0]);
+
+    const double max_freq = *std::max_element(freqs.begin(), freqs.end());
+    if (max_freq == 0)
+      break; // all channel inputs have ended
+    else if (max_freq != frequency) {
+      frequency = max_freq;
+      ticker.set_period(1 / frequency);
+    }
+
+    if (free_run)
+      continue;
+
+    // Commands due before the next tick are run on time
+    timeval settle_time, next_tick = ticker.get_next_tick();
+    int settle_idx;
+    while (settles.next(&settle_time, &settle_idx) &&
+           timercmp(&settle_time, &next_tick, <)) {
+      settles.pop();
+      sleep_until_time(settle_time);
+      Status stat;
+      if ((stat = dials[settle_idx]->settle(settle_time)).is_error())
+        return stat;
+    }
+
+    // Overruns skip the ticks that have passed, and later channel reads
+    // stay on their schedule
+    ticker.sleep_until_next();
+    for (auto idx : scan_idxs)
+      dials[idx]->set_tick_stats(ticker.get_stats());
   }
 
-  return str;
+  return end_stat;
 }
 
-std::string DialSettings::settings_report() const
+namespace {
+// Convert a sample in an IIO buffer to an integer
+long long convert_sample(const iio_channel *chan, const void *src)
 {
-  string str;
-  str += msg_str("  enabled = %d\n", enabled);
-  str += msg_str("  turn_before_run = %d\n", turn_before_run);
-  str += msg_str("  command_delay = %g\n", command_delay);
-  str += msg_str("  overlap = %g\n", overlap * 100); // convert to %
-  str += msg_str("  frequency = %g\n", frequency);
-  str += msg_str("  run_commands = %d\n", run_commands);
-  str += msg_str("  print_commands = %d\n", print_commands);
-  str += "\n";
-  if (commands.size()) {
-    for (auto kp : commands)
-      str += msg_str("  %7ld = %s, %s\n", kp.first, kp.second.label.c_str(),
-                     kp.second.command.c_str());
-    str += "\n";
+  const auto *fmt = iio_channel_get_data_format(chan);
+  unsigned char buf[8] = {0};
+  iio_channel_convert(chan, buf, src);
+  switch (fmt->length) {
+  case 8:
+    return fmt->is_signed ? (long long)*(int8_t *)buf : *(uint8_t *)buf;
+  case 16:
+    return fmt->is_signed ? (long long)*(int16_t *)buf : *(uint16_t *)buf;
+  case 32:
+    return fmt->is_signed ? (long long)*(int32_t *)buf : *(uint32_t *)buf;
+  default:
+    return *(int64_t *)buf;
   }
-
-  return str;
 }
 
-Status Ads1x15::init(const DialSettings &default_settings, int num_channels)
+// Get the frequency of samples for a channel, oversampled channels need a
+// burst of samples for each reading
+double sample_frequency(const DialSettings &settings)
 {
-  context = iio_create_local_context();
-  device = iio_context_find_device(context, "ads1015");
-  if (device == nullptr)
-    return Status::error("could not open ADS1X15 device");
-  dials.clear();
-  for (int i = 0; i < num_channels; i++) {
-    dials.push_back(std::make_unique<Dial>());
-    *dials.back()->get_settings() = default_settings;
-  }
-  return Status::ok();
-};
+  Oversampler sampler;
+  sampler.init(settings.get_oversample());
+  return settings.get_frequency() * sampler.get_num_samples();
+}
+}; // namespace
 
-std::string Ads1x15::config_report() const
+Status Ads1x15::start_buffer_loop(const std::string &trigger_name)
 {
-  string report;
+  // Each IIO device has its own buffer, read by its own thread
+  vector<vector<int>> groups;
+  std::map<const void *, size_t> device_groups;
   for (size_t idx = 0; idx < dials.size(); idx++) {
-    const auto settings = dials[idx]->get_settings();
-    if (!settings->is_enabled())
-      continue; // Don't report disabled channels
+    if (!dials[idx]->get_settings()->is_enabled())
+      continue;
+    auto iio_input = dynamic_cast<IioInput *>(dials[idx]->get_input());
+    if (iio_input == nullptr)
+      return Status::error(msg_str("channel '%c': buffer mode can only read "
+                                   "IIO ADC inputs",
+                                   channel_idx_to_char(idx)));
+    auto it = device_groups.insert({iio_input->get_adc(), groups.size()}).first;
+    if (it->second == groups.size())
+      groups.push_back({});
+    groups[it->second].push_back(idx);
+  }
 
-    report += msg_str("\n== CHANNEL %c ==\n\n", channel_idx_to_char(idx));
-    report += "-- Configuration Settings --\n";
-    lock();
-    report += settings->settings_report();
-    unlock();
+  // A trigger that is named is shared by all the devices, and runs at the
+  // highest sample frequency of all their channels (the write fails
+  // harmlessly for triggers without a sampling frequency)
+  const iio_device *trigger = nullptr;
+  double trigger_freq = 0;
+  if (!trigger_name.empty()) {
+    trigger = iio_context_find_device(context, trigger_name.c_str());
+    if (trigger == nullptr || !iio_device_is_trigger(trigger))
+      return Status::error(
+          "could not find IIO trigger '" + trigger_name +
+          "' (an hrtimer trigger can be created with 'mkdir "
+          "/sys/kernel/config/iio/triggers/hrtimer/" +
+          trigger_name + "')");
+    for (const auto &group : groups)
+      for (auto idx : group)
+        trigger_freq = std::max(
+            trigger_freq, sample_frequency(*dials[idx]->get_settings()));
+    iio_device_attr_write_double(trigger, "sampling_frequency",
+                                 trigger_freq);
+  }
+
+  return run_groups(groups,
+                    [this, trigger, trigger_freq](const vector<int> &idxs) {
+                      return buffer_channels(idxs, trigger, trigger_freq);
+                    });
+}
 
-    report += "-- Band Settings --\n";
+Status Ads1x15::buffer_channels(const vector<int> &buf_idxs,
+                                const iio_device *trigger,
+                                double trigger_freq)
+{
+  auto adc =
+      static_cast<IioInput *>(dials[buf_idxs[0]]->get_input())->get_adc();
+  auto device = adc->get_device();
+  const string dev_desc = adc->get_description();
+
+  // Enable the scan elements for the channels
+  vector<iio_channel *> chans(dials.size(), nullptr);
+  vector<double> sample_freqs(dials.size(), 0);
+  double frequency = 0;
+  for (auto idx : buf_idxs) {
+    auto iio_input = static_cast<IioInput *>(dials[idx]->get_input());
+    string chan_id = "voltage" + std::to_string(iio_input->get_channel());
+    auto chan = iio_device_find_channel(device, chan_id.c_str(), false);
+    if (chan == nullptr || !iio_channel_is_scan_element(chan))
+      return Status::error(
+          msg_str("channel '%c': cannot make buffered reads from %s %s",
+                  channel_idx_to_char(idx), dev_desc.c_str(),
+                  chan_id.c_str()));
+    iio_channel_enable(chan);
+    chans[idx] = chan;
+    sample_freqs[idx] = sample_frequency(*dials[idx]->get_settings());
+    frequency = std::max(frequency, sample_freqs[idx]);
+  }
+  if (trigger)
+    frequency = trigger_freq; // shared trigger, set for all the devices
+
+  // The trigger runs at the highest channel sample frequency, and each
+  // channel takes every n'th scan, where n gives the nearest frequency to
+  // the channel sample frequency
+  vector<long> decimations(dials.size(), 1);
+  vector<long> scans_to_skip(dials.size(), 0);
+  for (auto idx : buf_idxs)
+    decimations[idx] = std::max(1L, std::lround(frequency / sample_freqs[idx]));
+
+  // Kernel timestamps, if available, give the time each sample was taken,
+  // on the monotonic clock used for all timing (the clock may be shared
+  // with other programs using the device, and will be reset at reboot).
+  // Otherwise readings are timed when they are processed.
+  auto ts_chan = iio_device_find_channel(device, "timestamp", false);
+  if (ts_chan != nullptr) {
+    if (iio_device_attr_write(device, "current_timestamp_clock",
+                              "monotonic") < 0) {
+      fprintf(stderr,
+              "warning: could not set the timestamp clock for %s, readings "
+              "are timed when they are processed\n",
+              dev_desc.c_str());
+      ts_chan = nullptr;
+    }
+    else
+      iio_channel_enable(ts_chan);
+  }
 
-    lock();
-    auto dial_bands = settings->create_dial_bands();
+  if (trigger) {
+    if (iio_device_set_trigger(device, trigger) != 0) {
+      const char *name = iio_device_get_name(trigger);
+      return Status::error("could not set IIO trigger '" +
+                           string(name ? name : iio_device_get_id(trigger)) +
+                           "' for " + dev_desc);
+    }
+  }
+  else if (iio_device_get_trigger(device, &trigger) != 0 || !trigger)
+    return Status::error(dev_desc + " has no IIO trigger, a trigger name "
+                                    "must be given");
+  else {
+    // The device's own trigger runs at the highest channel frequency (the
+    // write fails harmlessly for triggers without a sampling frequency)
+    iio_device_attr_write_double(trigger, "sampling_frequency", frequency);
+  }
 
-    report += settings->dial_bands_report(dial_bands);
-    unlock();
+  // Refill in blocks of about 10ms of samples
+  size_t block_size = std::max(1, int(frequency / 100));
+  auto buffer = std::unique_ptr<iio_buffer, decltype(&iio_buffer_destroy)>(
+      iio_device_create_buffer(device, block_size, false), &iio_buffer_destroy);
+  if (buffer.get() == nullptr)
+    return Status::error("could not create buffer for " + dev_desc + ": " +
+                         strerror(errno));
+
+  for (auto idx : buf_idxs)
+    dials[idx]->start_processing(false); // commands run in the background
+
+  while (!stop_groups) {
+    ssize_t ret = iio_buffer_refill(buffer.get());
+    if (ret < 0)
+      return Status::error("could not read buffer from " + dev_desc + ": " +
+                           strerror(-ret));
+
+    const auto step = iio_buffer_step(buffer.get());
+    const auto end = (const char *)iio_buffer_end(buffer.get());
+    const char *ts_ptr =
+        ts_chan ? (const char *)iio_buffer_first(buffer.get(), ts_chan)
+                : nullptr;
+    for (auto idx : buf_idxs) {
+      auto dial = dials[idx].get();
+      auto ptr = (const char *)iio_buffer_first(buffer.get(), chans[idx]);
+      for (ptrdiff_t offset = 0; ptr + offset < end; offset += step) {
+        if (scans_to_skip[idx]-- > 0)
+          continue;
+        scans_to_skip[idx] = decimations[idx] - 1;
+        timeval sample_time;
+        if (ts_ptr) {
+          long long ns = convert_sample(ts_chan, ts_ptr + offset);
+          sample_time.tv_sec = ns / 1000000000;
+          sample_time.tv_usec = (ns % 1000000000) / 1000;
+        }
+        long long raw = convert_sample(chans[idx], ptr + offset);
+        if (!dial->oversample(&raw))
+          continue; // burst is not complete
+        auto stat = dial->process_raw(raw, ts_ptr ? &sample_time : nullptr);
+        if (stat.is_error())
+          return stat;
+      }
+    }
   }
 
-  return report;
+  return Status::ok();
 }
 
-Status Ads1x15::read_raw(const std::string &attr, long long *raw)
+namespace {
+// Create a monotonic timer file, which is not set
+int create_timer_fd()
 {
-  Status stat;
-  lock();
-  auto adc_read_ret = iio_device_attr_read_longlong(device, attr.c_str(), raw);
-  unlock();
+  return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
 
-  if (adc_read_ret != 0)
-    stat.set_error("could not read values from ADS1X15 device from " + attr);
-  return stat;
+// Set a timer file to expire after a time, and then every period (or
+// only once if the period is 0). A negative time unsets the timer.
+void set_timer_fd(int fd, double secs, double period = 0)
+{
+  itimerspec spec = {};
+  if (secs >= 0) {
+    secs = std::max(secs, 1e-9); // a zero time would unset the timer
+    spec.it_value.tv_sec = long(secs);
+    spec.it_value.tv_nsec = long((secs - long(secs)) * 1e9);
+    spec.it_interval.tv_sec = long(period);
+    spec.it_interval.tv_nsec = long((period - long(period)) * 1e9);
+  }
+  timerfd_settime(fd, 0, &spec, nullptr);
 }
 
-Status Ads1x15::start_dial_loop(int idx)
+// Set a timer file to expire once at a time on the monotonic clock, or
+// unset it if the time is null
+void set_timer_fd_at(int fd, const timeval *tv)
 {
-  Status stat;
+  itimerspec spec = {};
+  if (tv != nullptr) {
+    spec.it_value.tv_sec = tv->tv_sec;
+    spec.it_value.tv_nsec = std::max(1L, long(tv->tv_usec) * 1000);
+  }
+  timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
 
-  auto dial = dials[idx].get();
-  const auto settings = dial->get_settings();
-  bool run_commands = settings->get_run_commands();
+// Read the number of times a timer has expired
+uint64_t read_timer_fd(int fd)
+{
+  uint64_t expirations = 0;
+  if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    expirations = 0;
+  return expirations;
+}
 
-  string attr_v_raw = "in_voltage" + std::to_string(idx) + "_raw";
+// Files that are closed when leaving scope
+struct FileCloser {
+  std::vector<int> fds;
+  ~FileCloser()
+  {
+    for (auto fd : fds)
+      if (fd >= 0)
+        close(fd);
+  }
+  int add(int fd)
+  {
+    fds.push_back(fd);
+    return fd;
+  }
+};
+}; // namespace
 
-  auto dial_bands = settings->create_dial_bands();
+Status Ads1x15::start_event_loop(double monitor_freq)
+{
+  // Each file watched by the event loop has a source, and the epoll event
+  // data is the source index
+  enum class Kind { schedule, input, settle, monitor, child };
+  struct Source {
+    Kind kind;
+    int idx; // channel index, or -1
+    int fd;
+  };
+  vector<Source> sources;
+
+  // Channel processing state
+  struct ChannelState {
+    int schedule_fd = -1;      // schedule timer, for polled inputs
+    Counter since_start;       // time since the schedule timer was set
+    double first = 0;          // time of the first expiration
+    long long expirations = 0; // expirations since the timer was set
+    TickStats stats;           // schedule statistics
+    bool ended = false;        // input has ended
+  };
+  vector<ChannelState> chan_states(dials.size());
+
+  FileCloser files;
+  int epoll_fd = files.add(epoll_create1(EPOLL_CLOEXEC));
+  if (epoll_fd < 0)
+    return Status::error(string("could not create event loop: ") +
+                         strerror(errno));
+  auto watch = [&](Kind kind, int idx, int fd) {
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = sources.size();
+    sources.push_back({kind, idx, fd});
+    if (fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+      return Status::error(string("could not add to event loop: ") +
+                           strerror(errno));
+    return Status::ok();
+  };
 
-  // dial postion mark for last raw value
-  long mark_last = DialBands::unset;
+  Status stat;
+  int num_active = 0; // channels whose input has not ended
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    if (!dials[idx]->get_settings()->is_enabled())
+      continue;
+    auto input = dials[idx]->get_input();
+    if (input == nullptr)
+      return Status::error(
+          msg_str("channel '%c': no input", channel_idx_to_char(idx)));
+
+    // Event driven inputs are read when they have a new reading, other
+    // inputs are read on a timer schedule
+    auto &state = chan_states[idx];
+    if (input->is_event_driven()) {
+      if (!(stat = watch(Kind::input, idx, input->get_event_fd())))
+        return stat;
+    }
+    else {
+      const double period = 1 / dials[idx]->get_settings()->get_frequency();
+      state.schedule_fd = files.add(create_timer_fd());
+      if (!(stat = watch(Kind::schedule, idx, state.schedule_fd)))
+        return stat;
+      set_timer_fd(state.schedule_fd, 0, period);
+      state.stats.period = period;
+      state.since_start.reset();
+    }
+    dials[idx]->start_processing(false); // commands run in the background
+    num_active++;
+  }
 
-  // check whether to execute current command on start, or wait for dial change
-  // (by setting a long intial delay on the same band before running command)
-  double initial_delay = (settings->get_turn_before_run())
-                             ? 10000000                       // long time
-                             : settings->get_command_delay(); // usual time
-  Timer timer(initial_delay);
+  // Commands are run when the dial settles, at the earliest settle time
+  // of all the channels
+  DeadlineQueue settles;
+  int settle_fd = files.add(create_timer_fd());
+  if (!(stat = watch(Kind::settle, -1, settle_fd)))
+    return stat;
 
-  bool first_loop = true;
-  while (true) {
-    long long raw;
-    if ((stat = read_raw(attr_v_raw, &raw)).is_error())
+  if (monitor_freq > 0) {
+    int timer_fd = files.add(create_timer_fd());
+    if (!(stat = watch(Kind::monitor, -1, timer_fd)))
       return stat;
+    set_timer_fd(timer_fd, 0, 1 / monitor_freq);
+  }
 
-    dial->set_raw(raw);
-
-    auto mark_now =
-        dial_bands.get_mark(raw, mark_last); // mark for current raw value
-    if (first_loop) {
-      mark_last = mark_now; // initially no change
-      first_loop = false;
-    }
-
-    // If current mark has changed then restart the timer
-    if (mark_now != mark_last)
-      timer.set_timer(settings->get_command_delay());
-
-    // check if the dial...
-    //    has been in the current band for the delay time, AND
-    //    is no longer in the last stop band, AND
-    //    the reading is set
-    if (timer.finished() && mark_now != dial->get_mark_stop() &&
-        mark_now != DialBands::unset) {
-      // dial has stopped in a new band
-      dial->set_mark_stop(mark_now);
-      auto cmd = settings->get_command(dial->get_mark_stop());
+  // Finished commands are reaped, and any queued command started, when
+  // SIGCHLD is received (it is blocked in all threads, see main())
+  sigset_t child_sigs;
+  sigemptyset(&child_sigs);
+  sigaddset(&child_sigs, SIGCHLD);
+  if (!(stat = watch(Kind::child, -1,
+                     files.add(signalfd(-1, &child_sigs,
+                                        SFD_NONBLOCK | SFD_CLOEXEC)))))
+    return stat;
 
-      if (settings->get_print_commands()) {
-        printf("\nCOMMAND (mark: %-10ld) %s: %s\n", dial->get_mark_stop(),
-               cmd.label.c_str(), cmd.command.c_str());
+  Status end_stat; // status of input ending
+  const int max_events = 16;
+  epoll_event events[max_events];
+  while (num_active > 0) {
+    int num_events = epoll_wait(epoll_fd, events, max_events, -1);
+    if (num_events < 0 && errno != EINTR)
+      return Status::error(string("event loop wait failed: ") +
+                           strerror(errno));
+
+    for (int i = 0; i < num_events; i++) {
+      const auto &src = sources[events[i].data.u32];
+      if (src.kind == Kind::monitor) {
+        read_timer_fd(src.fd);
+        printf("%-80s\r", monitor_line().c_str());
         fflush(stdout);
+        continue;
+      }
+      if (src.kind == Kind::child) {
+        signalfd_siginfo info;
+        while (read(src.fd, &info, sizeof(info)) == sizeof(info))
+          ;
+        for (size_t idx = 0; idx < dials.size(); idx++)
+          if (dials[idx]->get_settings()->is_enabled() &&
+              (stat = dials[idx]->poll_commands()).is_error())
+            return stat;
+        continue;
+      }
+      if (src.kind == Kind::settle) {
+        read_timer_fd(src.fd);
+        timeval now, settle_time;
+        get_monotonic_time(&now);
+        int idx;
+        while (settles.next(&settle_time, &idx) &&
+               !timercmp(&settle_time, &now, >)) {
+          settles.pop();
+          if ((stat = dials[idx]->settle(now)).is_error())
+            return stat;
+        }
+        continue;
       }
 
-      if (run_commands)
-        system(cmd.command.c_str());
-    }
+      auto dial = dials[src.idx].get();
+      auto input = dial->get_input();
+      auto &state = chan_states[src.idx];
+      if (state.ended)
+        continue;
+      else if (src.kind == Kind::schedule) {
+        // More than one expiration means readings were missed
+        const auto expirations = read_timer_fd(src.fd);
+        if (expirations == 0)
+          continue;
+        state.expirations += expirations;
+        auto &stats = state.stats;
+        stats.ticks++;
+        if (expirations > 1) {
+          stats.overruns++;
+          stats.missed += expirations - 1;
+        }
+        const double late = state.since_start.secs() - state.first -
+                            (state.expirations - 1) * stats.period;
+        stats.late_sum += late;
+        stats.late_max = std::max(stats.late_max, late);
+        dial->set_tick_stats(stats);
+      }
 
-    mark_last = mark_now;
+      // The loop must not wait on one input, so a reading is only made
+      // when it is ready
+      long long raw;
+      timeval sample_time;
+      bool has_read;
+      if ((stat = dial->read_input(&raw, &sample_time, &has_read)).is_error())
+        return stat;
+      if (stat.is_warning()) { // end of input, stop watching the channel
+        end_stat = stat;
+        state.ended = true;
+        settles.cancel(src.idx);
+        num_active--;
+        continue;
+      }
+      if (!has_read)
+        continue;
+
+      if ((stat = dial->process_raw(raw, &sample_time)).is_error())
+        return stat;
+      timeval settle_time;
+      if (dial->get_settle_time(&settle_time))
+        settles.set(src.idx, settle_time);
+      else
+        settles.cancel(src.idx);
+
+      if (input->is_event_driven())
+        continue;
+      else if (1 / dial->get_reading_frequency() != state.stats.period) {
+        // The schedule slows down while the dial is idle
+        const double period = 1 / dial->get_reading_frequency();
+        set_timer_fd(state.schedule_fd, period, period);
+        state.stats.period = period;
+        state.since_start.reset();
+        state.first = period;
+        state.expirations = 0;
+      }
+    }
 
-    usleep(1000000 / settings->get_frequency());
+    timeval settle_time;
+    int idx;
+    set_timer_fd_at(settle_fd,
+                    settles.next(&settle_time, &idx) ? &settle_time : nullptr);
   }
 
-  return stat;
+  return end_stat;
 }
 
 Status Ads1x15::start_loop()
@@ -344,43 +2436,62 @@ Status Ads1x15::start_loop()
   vector<std::thread> threads(num_channels);
   for (int idx = 0; idx < num_channels; idx++) {
     if (dials[idx]->get_settings()->is_enabled())
-      threads[idx] = std::thread(&Ads1x15::start_dial_loop, this, idx);
+      threads[idx] = std::thread(
+          [this, idx] { dials[idx]->set_status(start_dial_loop(idx)); });
   }
 
   for (int idx = 0; idx < num_channels; idx++) {
     if (threads[idx].joinable()) {
       threads[idx].join();
-      auto dial_status = dials[idx]->get_status();
-      // final status should be first occurence of worst status
-      if ((stat.is_ok() && !dial_status.is_ok()) ||
-          (stat.is_warning() && dial_status.is_error()))
-        stat = dial_status;
+      update_status(&stat, dials[idx]->get_status());
     }
   }
 
   return stat;
 }
 
-Status Ads1x15::monitor_loop(double frequency)
+vector<DialState> Ads1x15::get_dial_states() const
 {
-  while (true) {
-    string line;
-    int num_channels = dials.size();
-    for (int idx = 0; idx < num_channels; idx++) {
-      auto dial = dials[idx].get();
-      if (!dial->get_settings()->is_enabled())
-        continue; // Don't report disabled channels
+  // Collect the states until no state changed while they were collected,
+  // so the states were all current at one time. A dial that is read very
+  // often could stop this, so after a few tries the last states are used.
+  const int num_channels = dials.size();
+  vector<DialState> states(num_channels);
+  vector<unsigned> seqs(num_channels);
+  for (int tries = 0; tries < 8; tries++) {
+    for (int idx = 0; idx < num_channels; idx++)
+      seqs[idx] = dials[idx]->get_state(&states[idx]);
+    int idx = 0;
+    while (idx < num_channels && dials[idx]->get_state_sequence() == seqs[idx])
+      idx++;
+    if (idx == num_channels)
+      break;
+  }
+  return states;
+}
 
-      char channel_char = channel_idx_to_char(idx);
-      long long raw = dial->get_raw();
-      long mark_stop = dial->get_mark_stop();
-      if (mark_stop == DialBands::unset)
-        mark_stop = -1;
+string Ads1x15::monitor_line() const
+{
+  string line;
+  const auto states = get_dial_states();
+  for (size_t idx = 0; idx < states.size(); idx++) {
+    if (!dials[idx]->get_settings()->is_enabled())
+      continue; // Don't report disabled channels
 
-      line += msg_str("%c:%6lld (%6ld)  ", channel_char, raw, mark_stop);
-    }
+    long mark_stop = states[idx].mark_stop;
+    if (mark_stop == DialBands::unset)
+      mark_stop = -1;
+
+    line += msg_str("%c:%6lld (%6ld)  ", channel_idx_to_char(idx),
+                    states[idx].value, mark_stop);
+  }
+  return line;
+}
 
-    printf("%-80s\r", line.c_str());
+Status Ads1x15::monitor_loop(double frequency)
+{
+  while (true) {
+    printf("%-80s\r", monitor_line().c_str());
     fflush(stdout);
     usleep(1000000 / frequency);
   }
@@ -449,12 +2560,13 @@ Status Ads1x15::read_config_file(const string &file_name,
     return Status::error("could not open file");
 
   // config file has three kinds of lines:
-  //    CHANNEL a, b, c or d
+  //    CHANNEL a - z
   //    setting = value
   //    dial_reading = command_id , command
 
   int channel_char = '\0';          // current channel letter
   DialSettings *settings = nullptr; // current dial settings
+  std::set<char> channels_seen;     // channel letters with a section
 
   char *line;
   int line_no = 0;
@@ -466,7 +2578,6 @@ Status Ads1x15::read_config_file(const string &file_name,
     if (line_str.empty())
       continue;
 
-    std::set<char> channels_seen;
     string msg_prefix_line = "line " + std::to_string(line_no) + ": ";
     // Check for CHANNEL
     const string channel_label = "CHANNEL";
@@ -478,8 +2589,8 @@ Status Ads1x15::read_config_file(const string &file_name,
       if (channel_str.size() > 1)
         return Status::error(msg_prefix_channel + "more than one letter given");
       channel_char = tolower(channel_str[0]);
-      const string channel_letters = "abcd";
-      if (channel_letters.find(channel_char) == string::npos)
+      if (channel_char < 'a' ||
+          channel_char_to_idx(channel_char) >= (int)dials.size())
         return Status::error(msg_prefix_channel + "unknown channel letter '" +
                              channel_str + "'");
       const auto already_seen = !channels_seen.insert(channel_char).second;
@@ -504,10 +2615,12 @@ Status Ads1x15::read_config_file(const string &file_name,
 
     auto setting = trim(line_str.substr(0, pos_equal));
 
-    // check if setting is setting string or dial reading number
+    // check if setting is setting string, dial reading number or range
     int dial_reading;
-    if (read_int(setting.c_str(), &dial_reading)) {
+    const bool is_range = (setting.find("..") != string::npos);
+    if (is_range || read_int(setting.c_str(), &dial_reading)) {
       // line: dial_reading = command_id , command
+      //   or: start..end step step [values first..last] = label, command
       string msg_prefix_cmd = msg_prefix_line + "dial command: ";
 
       // split value on first ','
@@ -522,7 +2635,10 @@ Status Ads1x15::read_config_file(const string &file_name,
       // command after first ','
       string cmd_command = trim(line_str.substr(pos_comma + 1));
 
-      Status stat = settings->set_command(dial_reading, cmd_label, cmd_command);
+      Status stat =
+          (is_range)
+              ? settings->set_command_range(setting, cmd_label, cmd_command)
+              : settings->set_command(dial_reading, cmd_label, cmd_command);
       if (!stat)
         return Status::error(msg_prefix_line + "dial command: " + stat.msg());
     }
@@ -542,13 +2658,227 @@ Status Ads1x15::read_config_file(const string &file_name,
     const auto settings = dials[idx]->get_settings();
     enabled_count += settings->is_enabled();
     if (settings->is_enabled() && settings->get_run_commands() &&
-        settings->get_commands().size() < 2)
+        settings->get_num_marks() < 2)
       return Status::error(
           msg_str("channel '%c' included less than two commands",
                   channel_idx_to_char(idx)));
+    // Only inputs that make a new conversion for each read are oversampled
+    const auto input_type = split_words(settings->get_input())[0];
+    Oversampler sampler;
+    sampler.init(settings->get_oversample());
+    if (settings->is_enabled() && sampler.is_set() && input_type != "adc" &&
+        input_type != "iio" && input_type != "sim")
+      return Status::error(
+          msg_str("channel '%c': oversample is not available with %s input",
+                  channel_idx_to_char(idx), input_type.c_str()));
   }
   if (enabled_count == 0)
     return Status::error("file contained no CHANNEL sections");
 
+  for (auto &dial : dials)
+    dial->compile_program(); // settings are fixed from here on
+  return Status::ok();
+}
+
+bool Ads1x15::has_builtin_config()
+{
+#ifdef BUILTIN_CONFIG_FILE
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::string Ads1x15::builtin_config_name()
+{
+#ifdef BUILTIN_CONFIG_FILE
+  return builtin_config::file_name;
+#else
+  return "";
+#endif
+}
+
+Status Ads1x15::init_builtin(const DialSettings &default_settings)
+{
+#ifdef BUILTIN_CONFIG_FILE
+  auto stat = init(default_settings);
+  if (!stat)
+    return stat;
+  for (const auto &chan : builtin_config::channels) {
+    if (chan.idx < 0 || chan.idx >= (int)dials.size())
+      return Status::error(msg_str("builtin channel index %d is out of range",
+                                   chan.idx));
+    auto dial = dials[chan.idx].get();
+    dial->get_settings()->set_builtin(chan);
+    dial->set_builtin(&chan);
+    dial->compile_program();
+  }
+  return Status::ok();
+#else
+  (void)default_settings;
+  return Status::error("program was built without a builtin configuration");
+#endif
+}
+
+namespace {
+// Write a double, so that it reads back as the same value
+string cpp_double(double val)
+{
+  string str = msg_str("%g", val);
+  if (strtod(str.c_str(), nullptr) != val)
+    str = msg_str("%.17g", val);
+  if (str.find_first_of(".en") == string::npos)
+    str += ".0";
+  return str;
+}
+
+// Readings that check the compiled bands, at and either side of the start
+// of each band, turning the dial up and down, and at each band start when
+// the current mark is each mark of the band. The mark for each is found
+// by searching the map of bands.
+vector<string> cpp_checks(const DialBands &bands)
+{
+  vector<string> items;
+  const auto &band_map = bands.get_bands();
+  if (band_map.empty())
+    return items;
+
+  std::set<long> reading_set = {band_map.begin()->first - 1000,
+                                band_map.rbegin()->first + 1000};
+  for (const auto &kp : band_map)
+    for (long kval : {kp.first - 1, kp.first, kp.first + 1})
+      reading_set.insert(kval);
+  const vector<long> readings(reading_set.begin(), reading_set.end());
+
+  auto add_check = [&](long kval, long cur_mark) {
+    const long mark = bands.get_mark_by_map(kval, cur_mark);
+    items.push_back(msg_str("{%s, %s, %s}", cpp_long(kval).c_str(),
+                            cpp_long(cur_mark).c_str(),
+                            cpp_long(mark).c_str()));
+    return mark;
+  };
+  long mark = DialBands::unset;
+  for (auto it = readings.begin(); it != readings.end(); ++it)
+    mark = add_check(*it, mark);
+  mark = DialBands::unset;
+  for (auto it = readings.rbegin(); it != readings.rend(); ++it)
+    mark = add_check(*it, mark);
+  for (const auto &kp : band_map) {
+    add_check(kp.first, kp.second.first);
+    add_check(kp.first, kp.second.second);
+  }
+  return items;
+}
+}; // namespace
+
+Status Ads1x15::write_cpp(const string &file_name,
+                          const string &config_name) const
+{
+  string out = msg_str(
+      "// Configuration compiled into turnandrun, written by turnandrun -E\n"
+      "// from the configuration file %s.\n"
+      "// Build with ./configure --with-builtin-config=/path/to/this/file\n"
+      "// Do not edit, write the file again when the configuration changes.\n"
+      "\n"
+      "#ifndef TURNANDRUN_BUILTIN_CONFIG_H\n"
+      "#define TURNANDRUN_BUILTIN_CONFIG_H\n"
+      "\n"
+      "#include \"builtin.h\"\n"
+      "\n"
+      "namespace builtin_config {\n"
+      "\n"
+      "constexpr const char *file_name = %s;\n",
+      cpp_string(config_name).c_str(), cpp_string(config_name).c_str());
+
+  vector<string> channel_names;
+  for (size_t idx = 0; idx < dials.size(); idx++) {
+    // The builtin tables have no repeating bands, so each mark of a range
+    // is written as a separate command
+    const auto settings = dials[idx]->get_program()->get_settings().expanded();
+    if (!settings.is_enabled())
+      continue;
+    const auto bands = settings.create_dial_bands();
+
+    const string name = msg_str("channel_%c", channel_idx_to_char(idx));
+    channel_names.push_back(name);
+    out += msg_str("\n// CHANNEL %c\n", channel_idx_to_char(idx));
+
+    vector<string> items;
+    for (const auto &kp : settings.get_commands())
+      items.push_back(msg_str("{%s, %s, %s}", cpp_long(kp.first).c_str(),
+                              cpp_string(kp.second.label).c_str(),
+                              cpp_string(kp.second.command).c_str()));
+    if (!items.empty())
+      out += "constexpr BuiltinCommand " + name + "_commands[] = {\n" +
+             cpp_list(items) + "};\n";
+    const int num_commands = items.size();
+
+    string band_fields;
+    out += bands.cpp_tables(name, &band_fields);
+
+    items = cpp_checks(bands);
+    if (!items.empty())
+      out += "constexpr BuiltinCheck " + name + "_checks[] = {\n" +
+             cpp_list(items) + "};\n";
+    const int num_checks = items.size();
+
+    out += "constexpr BuiltinChannel " + name + " = {\n";
+    out += msg_str("    %d, // channel %c\n", int(idx),
+                   channel_idx_to_char(idx));
+    out += "    " + cpp_string(settings.get_input()) + ", // input\n";
+    out += "    " + cpp_string(settings.get_oversample()) + ", // oversample\n";
+    out += "    " + cpp_string(settings.get_filter()) + ", // filter\n";
+    out += msg_str("    %s, // turn_before_run\n",
+                   settings.get_turn_before_run() ? "true" : "false");
+    out += "    " + cpp_double(settings.get_command_delay()) +
+           ", // command_delay\n";
+    const auto mode = settings.get_settle_mode();
+    out += "    " + cpp_string(DialSettings::settle_mode_name(mode)) +
+           ", // settle_mode\n";
+    out += "    " + cpp_double(settings.get_settle_velocity()) +
+           ", // settle_velocity\n";
+    out += msg_str("    %d, // settle_window\n", settings.get_settle_window());
+    out += "    " + cpp_double(settings.get_settle_noise()) +
+           ", // settle_noise\n";
+    out += "    " + cpp_double(settings.get_overlap()) + ", // overlap\n";
+    out += "    " + cpp_double(settings.get_frequency()) + ", // frequency\n";
+    out += "    " + cpp_double(settings.get_frequency_idle()) +
+           ", // frequency_idle\n";
+    out += msg_str("    %s, // event_wakeup\n",
+                   settings.get_event_wakeup() ? "true" : "false");
+    out += "    " + cpp_double(settings.get_idle_delay()) +
+           ", // idle_delay\n";
+    out += msg_str("    %s, // run_commands\n",
+                   settings.get_run_commands() ? "true" : "false");
+    out += msg_str("    %s, // print_commands\n",
+                   settings.get_print_commands() ? "true" : "false");
+    out += msg_str("    %s, %d, // commands\n",
+                   num_commands ? (name + "_commands").c_str() : "nullptr",
+                   num_commands);
+    out += band_fields;
+    out += msg_str("    %s, %d, // checks\n",
+                   num_checks ? (name + "_checks").c_str() : "nullptr",
+                   num_checks);
+    out += "};\n";
+    out += msg_str("static_assert(builtin_check(%s),\n"
+                   "              \"channel %c: compiled bands differ from "
+                   "the configuration\");\n",
+                   name.c_str(), channel_idx_to_char(idx));
+  }
+  if (channel_names.empty())
+    return Status::error("configuration has no enabled channels");
+
+  out += "\nconstexpr BuiltinChannel channels[] = {\n" +
+         cpp_list(channel_names) + "};\n";
+  out += "\n}; // namespace builtin_config\n"
+         "\n"
+         "#endif // TURNANDRUN_BUILTIN_CONFIG_H\n";
+
+  auto file = std::unique_ptr<FILE, decltype(&fclose)>(
+      fopen(file_name.c_str(), "w"), &fclose);
+  if (file.get() == NULL)
+    return Status::error(msg_str("could not open file: %s", strerror(errno)));
+  if (fputs(out.c_str(), file.get()) < 0 || fflush(file.get()) != 0)
+    return Status::error(msg_str("could not write file: %s", strerror(errno)));
   return Status::ok();
 }
@@ -25,11 +25,23 @@
 #ifndef DIAL_H
 #define DIAL_H
 
+#include "ads1x15_i2c.h"
+#include "builtin.h"
+#include "command.h"
+#include "filter.h"
+#include "iio_adc.h"
+#include "input.h"
+#include "record.h"
+#include "seqlock.h"
 #include "status_msg.h"
 #include "timer.h"
+#include "trace.h"
 
 #include <iio.h>
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <limits>
 #include <map>
 #include <memory>
@@ -42,15 +54,99 @@
 class DialBands {
 public:
   static const long unset = std::numeric_limits<long>::min();
-  void add_band(long k, long select, long stay) { bands[k] = {select, stay}; }
+  static const int max_table_size = 4096; ///< most entries in lookup table
+  void add_band(long k, long select, long stay)
+  {
+    bands[k] = {select, stay};
+    table.clear(); // no longer compiled
+  }
+
+  /// Add bands that repeat between evenly spaced marks
+  /** The marks are \c first and the \c num_steps marks after it, every
+   *  \c step readings. The bands between each mark and the next are found
+   *  from their offset from the lower mark, and take precedence over
+   *  bands added with add_band() from \c first up to the last mark.
+   * \param first the first mark
+   * \param step the readings between marks
+   * \param num_steps the number of marks after the first
+   * \param step_bands the bands between mark 0 and mark \c step. */
+  void add_run(long first, long step, long num_steps,
+               const std::map<long, std::pair<long, long>> &step_bands);
+
+  /// Compile the bands into a lookup table, for a faster get_mark()
+  /** The range of readings with bands is split into up to max_table_size
+   *  equal slots, each holding the first band for its slot. Bands added
+   *  after compiling are found with the map until compile() is called
+   *  again. */
+  void compile();
+
+  /// Get the mark for a reading
+  /**\param kval the reading
+   * \param cur_val the current mark
+   * \return The mark. */
   long get_mark(long kval, long cur_val) const;
+
+  /// Get the mark for a reading, searching the map of bands
+  /** Gives the same result as get_mark(), without the lookup table.
+   * \param kval the reading
+   * \param cur_val the current mark
+   * \return The mark. */
+  long get_mark_by_map(long kval, long cur_val) const;
+
+  bool get_mark_range(long mark, long *low, long *high) const;
+  bool in_select_zone(long kval, long mark) const;
+
+  /// Set the bands from compiled bands
+  /** The lookup table is used as it was compiled, see cpp_tables().
+   * \param chan the channel with the compiled bands. */
+  void set_compiled(const BuiltinChannel &chan);
+
+  /// Get C++ definitions of the compiled bands, see BuiltinChannel
+  /**\param prefix the start of the array names
+   * \param fields used to return the BuiltinChannel fields for the bands,
+   *  from \c bands to \c table_shift
+   * \return The array definitions. */
+  std::string cpp_tables(const std::string &prefix, std::string *fields) const;
+
+  /// Get the bands added with add_band()
+  /**\return The bands, by first reading, with their select and stay
+   *  marks. Bands added with add_run() are not included. */
   const std::map<long, std::pair<long, long>> &get_bands() const
   {
     return bands;
   }
 
+  /// Check whether there are bands added with add_run()
+  /**\return \c true if there are repeating bands. */
+  bool has_runs() const { return !runs.empty(); }
+
 private:
   std::map<long, std::pair<long, long>> bands;
+
+  // bands between evenly spaced marks, in order of first mark
+  struct RunBand {
+    long offset;       // first reading of the band, from the lower mark
+    bool select_upper; // selects the upper mark, otherwise the lower
+    bool stay_upper;   // stays on the upper mark, otherwise the lower
+  };
+  struct Run {
+    long first;                 // first mark
+    long step;                  // readings between marks
+    long end;                   // last mark
+    std::vector<RunBand> bands; // bands between a mark and the next
+  };
+  std::vector<Run> runs;
+  const Run *find_run(long kval) const;
+  std::pair<long, long> run_band(const Run &run, long kval) const;
+
+  // compiled bands, in flat arrays in key order
+  std::vector<long> keys;                    // start of each band
+  std::vector<std::pair<long, long>> vals;   // select and stay marks
+  std::vector<uint16_t> table;               // first band in each slot
+  long table_base = 0;                       // reading at start of table
+  int table_shift = 0;                       // log2 of readings per slot
+  const std::pair<long, long> &find_band(long kval) const;
+  std::pair<long, long> band_at(long kval) const;
 };
 
 class DialSettings {
@@ -60,114 +156,510 @@ public:
     std::string command;
   };
 
+  /// How to tell that the dial has stopped on a mark
+  enum class SettleMode { delay, predict, variance };
+
+  /// Get the name of a settle mode
+  /**\param mode the settle mode
+   * \return The name, as used in a configuration file. */
+  static const char *settle_mode_name(SettleMode mode);
+
+  /// Find a settle mode from its name
+  /**\param name the name, as used in a configuration file
+   * \param mode used to return the settle mode
+   * \return \c true if the name was a settle mode, otherwise \c false. */
+  static bool find_settle_mode(const std::string &name, SettleMode *mode);
+
+  /// Marks every step readings, with commands made from templates
+  struct CommandRange {
+    long start;        // first mark
+    long step;         // readings between marks
+    long count;        // number of marks
+    long value_first;  // {value} for the first mark
+    long value_last;   // {value} for the last mark
+    std::string label;   // label template
+    std::string command; // command template
+    long mark(long i) const { return start + i * step; }
+    long last() const { return mark(count - 1); }
+  };
+
   Command get_command(long dial_reading) const;
   Status set_command(int dial_reading, std::string cmd_label,
                      std::string cmd_command);
+
+  /// Set commands for a range of marks
+  /** The range is given as <tt>start..end step step [values first..last]</tt>
+   *  and has a mark every step readings from start, up to end. In the
+   *  label and command, {i} is replaced by the number of the mark in the
+   *  range from 0, {mark} by the dial reading of the mark, and {value} by
+   *  a value that changes evenly from first, for the first mark, to last,
+   *  for the last mark (by default, the same as {i}).
+   * \param range the range
+   * \param cmd_label the label template
+   * \param cmd_command the command template
+   * \return status, evaluates to \c true if the range was valid and does
+   *  not overlap other marks. */
+  Status set_command_range(const std::string &range, std::string cmd_label,
+                           std::string cmd_command);
+
+  /// Get the command for a mark in a range
+  /** The label and command are made from the templates of the range.
+   * \param mark the mark
+   * \param cmd used to return the command
+   * \return \c true if the mark is in a range, otherwise \c false. */
+  bool get_range_command(long mark, Command *cmd) const;
+
+  /// Get the ranges of marks
+  /**\return The ranges, in mark order. */
+  const std::vector<CommandRange> &get_command_ranges() const
+  {
+    return ranges;
+  }
+
+  /// Get the number of marks, including the marks of ranges
+  /**\return The number of marks. */
+  long get_num_marks() const;
+
+  /// Get the settings with each mark of a range as a separate command
+  /**\return The settings. */
+  DialSettings expanded() const;
   Status set_setting(std::string setting, std::string value);
 
   bool get_turn_before_run() const { return turn_before_run; }
   double get_command_delay() const { return command_delay; }
+  SettleMode get_settle_mode() const { return settle_mode; }
+  double get_settle_velocity() const { return settle_velocity; }
+  int get_settle_window() const { return settle_window; }
+  double get_settle_noise() const { return settle_noise; }
   double get_overlap() const { return overlap; }
   double get_frequency() const { return frequency; }
+  double get_frequency_idle() const { return frequency_idle; }
+  const std::string &get_input() const { return input; }
+  const std::string &get_filter() const { return filter; }
+  const std::string &get_oversample() const { return oversample; }
+  bool is_adc_input() const { return input == "adc"; }
+  bool get_event_wakeup() const { return event_wakeup; }
+  double get_idle_delay() const { return idle_delay; }
   void set_print_commands(bool flag = true) { print_commands = flag; }
   bool get_print_commands() const { return print_commands; }
   void set_run_commands(bool flag = true) { run_commands = flag; }
   bool get_run_commands() const { return run_commands; }
   void set_enabled(bool flag = true) { enabled = flag; }
-  bool is_enabled() { return enabled; }
-  std::map<long, Command> get_commands() const { return commands; }
+  bool is_enabled() const { return enabled; }
+  const std::map<long, Command> &get_commands() const { return commands; }
   DialBands create_dial_bands() const;
   std::string dial_bands_report(const DialBands &dial_bands) const;
   std::string settings_report() const;
 
+  /// Set the settings and commands from a channel compiled into the program
+  /** Commands are only run if they are run by both these settings and the
+   *  channel, and printed if they are printed by either.
+   * \param chan the channel. */
+  void set_builtin(const BuiltinChannel &chan);
+
 private:
   std::map<long, Command> commands; // dial setting to command
+  std::vector<CommandRange> ranges; // ranges of marks, in order
   double command_delay = 1;         // secs stopped before command is run
+  SettleMode settle_mode = SettleMode::delay; // how to tell dial stopped
+  double settle_velocity = 1000;    // units/sec below which dial is still
+  int settle_window = 5;            // readings for predict and variance
+  double settle_noise = 0;          // noise std dev, 0 to calibrate
   double overlap = 0.05;            // dead fraction between bands
   double frequency = 10.0;          // polling frequency
+  double frequency_idle = 0;        // polling frequency when idle, 0 if none
   bool turn_before_run = true;      // turn dial before first command is run
   bool print_commands = false;      // print selected command to screen
   bool run_commands = true;         // run selected command
   bool enabled = false;             // is enabled
+  bool event_wakeup = false;        // sleep until reading leaves mark range
+  double idle_delay = 5;            // secs on same mark before idling
+  std::string input = "adc";        // input source specification
+  std::string filter = "none";      // noise filter specification
+  std::string oversample = "1";     // readings in a burst, and reducer
+};
+
+/// Settings, bands and commands of a channel, compiled for processing
+/** A program is not changed after it is made, so it can be shared between
+ *  threads without a lock. New settings are applied with a new program. */
+class ChannelProgram {
+public:
+  /// Constructor
+  /**\param dial_settings the settings to compile. */
+  explicit ChannelProgram(const DialSettings &dial_settings);
+
+  /// Constructor, with bands that are already compiled
+  /**\param dial_settings the settings to compile
+   * \param dial_bands the bands for the settings. */
+  ChannelProgram(const DialSettings &dial_settings, DialBands dial_bands);
+
+  /// Get the settings
+  /**\return The settings. */
+  const DialSettings &get_settings() const { return settings; }
+
+  /// Get the bands
+  /**\return The bands, compiled for lookup. */
+  const DialBands &get_bands() const { return bands; }
+
+  /// Get the command for a mark
+  /** The command for a mark in a range is made when it is needed.
+   * \param mark the mark
+   * \param cmd used to return the command
+   * \return \c true if the mark has a command, otherwise \c false. */
+  bool get_command(long mark, DialSettings::Command *cmd) const;
+
+  /// Get a report of the settings and bands
+  /**\return The report. */
+  std::string report() const;
+
+private:
+  DialSettings settings;
+  DialBands bands;
+  std::vector<long> command_marks;               // marks, in order
+  std::vector<DialSettings::Command> commands; // command for each mark
+};
+
+/// State of a dial after a reading is processed
+struct DialState {
+  uint64_t sample = 0;              // number of readings processed
+  timeval time = {};                // sample time of the last reading
+  long long raw = 999999;           // last raw reading (init to dummy)
+  long long value = 999999;         // last reading after filtering
+  long mark = DialBands::unset;     // dial mark for the last reading
+  long mark_stop = DialBands::unset; // dial mark that was last stopped on
+  double noise_var = -1;            // variance at rest, -1 if not known
 };
 
 class Dial {
 public:
+  Dial() : program(std::make_shared<ChannelProgram>(settings)) {}
+
   void lock() const { dial_reading_mutex.lock(); }
   void unlock() const { dial_reading_mutex.unlock(); }
 
-  long get_mark_stop() const
+  /// Get the state published after the last reading was processed
+  /** The state is published by the processing thread without a lock, and
+   *  may be read from any thread without delaying that thread.
+   * \return The state. */
+  DialState get_state() const { return state.load(); }
+
+  /// Get the state and its sequence number
+  /**\param dial_state used to return the state
+   * \return The sequence number, which changes when a new state is
+   *  published, see get_state_sequence(). */
+  unsigned get_state(DialState *dial_state) const
   {
-    lock();
-    auto mark_copy = mark_stop;
-    unlock();
-    return mark_copy;
+    return state.load(dial_state);
+  }
+
+  /// Get the sequence number of the published state
+  /**\return The sequence number. */
+  unsigned get_state_sequence() const { return state.sequence(); }
+  /// Compile the settings into a new program, and publish it
+  /** The new program is used from the next reading processed. */
+  void compile_program();
+
+  /// Set the channel compiled into the program that the settings are from
+  /** The program then uses the compiled bands, rather than compiling them
+   *  again from the settings.
+   * \param chan the channel, or \c nullptr if the settings are not from a
+   *  compiled channel. */
+  void set_builtin(const BuiltinChannel *chan) { builtin = chan; }
+
+  /// Get the channel compiled into the program that the settings are from
+  /**\return The channel, or \c nullptr if the settings were read. */
+  const BuiltinChannel *get_builtin() const { return builtin; }
+
+  /// Get the published program
+  /**\return The program. */
+  std::shared_ptr<const ChannelProgram> get_program() const
+  {
+    return std::atomic_load(&program);
   }
-  void set_mark_stop(long mark)
+
+  /// Get the generation of the published program
+  /**\return The generation, which changes when a program is published. */
+  unsigned get_program_generation() const
   {
-    lock();
-    mark_stop = mark;
-    unlock();
+    return program_gen.load(std::memory_order_acquire);
   }
-  long get_raw() const
+
+  DialSettings *get_settings() { return &settings; }
+  const DialSettings *get_settings() const { return &settings; }
+  TickStats get_tick_stats() const
   {
     lock();
-    auto raw_copy = raw;
+    auto stats_copy = tick_stats;
     unlock();
-    return raw_copy;
+    return stats_copy;
   }
-  void set_raw(long raw_val)
+  void set_tick_stats(const TickStats &stats)
   {
     lock();
-    raw = raw_val;
+    tick_stats = stats;
     unlock();
   }
-  DialBands get_dial_bands() const
+  StageTrace get_stage_trace() const
   {
     lock();
-    auto bands = settings.create_dial_bands();
+    auto trace_copy = stage_trace;
     unlock();
-    return bands;
+    return trace_copy;
   }
-
-  DialSettings *get_settings() { return &settings; }
-  const DialSettings *get_settings() const { return &settings; }
   void set_status(Status stat) { status = stat; }
   Status get_status() const { return status; }
+  void set_input(std::unique_ptr<InputSource> in) { input = std::move(in); }
+  InputSource *get_input() { return input.get(); }
+  void set_recorder(Recorder *rec, int channel)
+  {
+    recorder = rec;
+    record_channel = channel;
+  }
+
+  /// Time the stages from a turn to a command, see get_stage_trace()
+  /**\param flag whether to trace the stages. */
+  void set_tracing(bool flag = true);
+
+  /// Read the input, timing the read when tracing
+  /** When oversampling, a burst of readings is made and reduced to one.
+   * \param raw_val used to return the raw reading
+   * \param sample_time used to return the time the reading was taken
+   * \param has_read if set, the input is not waited on, and this is used
+   *  to return whether a reading was made
+   * \return status, as returned by InputSource::read(). */
+  Status read_input(long long *raw_val, timeval *sample_time,
+                    bool *has_read = nullptr);
+
+  /// Add a reading to an oversampling burst
+  /**\param raw_val the reading, and used to return the reduced reading
+   *  when the burst is complete
+   * \return \c true if there is a reading to process, which is any
+   *  reading when not oversampling. */
+  bool oversample(long long *raw_val);
+
+  /// Prepare to process readings, called before the first process_raw()
+  /**\param wait whether to wait for each command to finish before
+   *  returning from process_raw(), otherwise commands run in the
+   *  background. */
+  void start_processing(bool wait = true);
+
+  /// Process a raw reading, and run the command for a newly stopped on mark
+  /**\param raw_val the raw reading
+   * \param sample_time time the reading was taken, or \c nullptr to use
+   *  the current time
+   * \return status, evaluates to \c true unless a command could not be
+   *  started. */
+  Status process_raw(long long raw_val, const timeval *sample_time = nullptr);
+
+  /// Check for a finished background command, and start any queued command
+  /**\return status, evaluates to \c true unless a command could not be
+   *  started. */
+  Status poll_commands();
+
+  /// Get the frequency to read the dial at
+  /**\return The idle frequency if it is set, any command has run and
+   *  the mark has not changed for the idle delay, otherwise the frequency. */
+  double get_reading_frequency() const;
+
+  /// Get the time the dial reading has stayed on the current mark
+  /**\return The number of seconds since the mark last changed */
+  double get_still_secs() const { return still.secs(); }
+
+  /// Run the command for the current mark if the dial has settled on it
+  /** The dial has settled when the mark has not changed for the command
+   *  delay. Call at the settle time (see get_settle_time()) to run the
+   *  command without waiting for the next reading.
+   * \param now the current time
+   * \return status, evaluates to \c true unless a command could not be
+   *  started. */
+  Status settle(const timeval &now);
+
+  /// Check whether the dial has stopped in the select zone of its mark
+  /** Only with settle_mode predict or variance, otherwise the dial has
+   *  only stopped when the command delay has passed.
+   * \return \c true if the dial has stopped. */
+  bool has_stopped() const;
+
+  /// Get the noise of the readings when the dial is at rest
+  /**\return The standard deviation, set or calibrated, for settle_mode
+   *  variance, or -1 if it is not known. */
+  double get_noise_floor() const;
+
+  /// Get the time a command is due, if the reading stays on its mark
+  /**\param settle_time used to return the time on the monotonic clock
+   * \return \c true if a command is waiting to run, otherwise \c false. */
+  bool get_settle_time(timeval *settle_time) const;
+
+  /// Get the time until a command is due, if the reading stays on its mark
+  /**\return The number of seconds until the command for the current mark
+   *  is run, or -1 if no command is waiting to run. */
+  double get_pending_secs() const;
+
+  /// Get the range of readings that stay on the current mark
+  /**\param low used to return the lowest reading in the range, or
+   *  DialBands::unset (\c std::numeric_limits<long>::min()) if there is
+   *  no lower limit
+   * \param high used to return one more than the highest reading in the
+   *  range, or \c std::numeric_limits<long>::max() if there is no limit
+   * \return \c true if there is a current mark, otherwise \c false. */
+  bool get_stay_range(long *low, long *high) const
+  {
+    return prog->get_bands().get_mark_range(mark_last, low, high);
+  }
 
 private:
   DialSettings settings;                 // Configuration settings
-  long mark_stop = DialBands::unset;     // dial mark that was last stopped on
-  long long raw = 999999;                // last raw reading (init to dummy)
-  mutable std::mutex dial_reading_mutex; // mutex for accessing readings
+  SeqLock<DialState> state;              // published processing state
+  const BuiltinChannel *builtin = nullptr; // compiled settings, if used
+  mutable std::mutex dial_reading_mutex; // mutex for accessing statistics
   Status status;                         // last error
+  TickStats tick_stats;                  // reading schedule statistics
+  std::unique_ptr<InputSource> input;    // source of readings
+  Recorder *recorder = nullptr;          // records readings, if set
+  int record_channel = 0;                // channel index for recording
+  bool tracing = false;                  // time the stages of commands
+  StageTrace stage_trace;                // stage latencies, if tracing
+  void add_trace(StageTrace::Stage stage, long usecs)
+  {
+    lock();
+    stage_trace.add(stage, usecs);
+    unlock();
+  }
+
+  // The program is published to any thread, and the generation changes
+  // when a new program is published, so the processing thread checks the
+  // generation for each reading without a lock
+  std::shared_ptr<const ChannelProgram> program; // current program
+  std::atomic<unsigned> program_gen{0};          // program generation
+
+  // processing state, only used by the thread processing the readings
+  std::shared_ptr<const ChannelProgram> prog; // program being processed
+  unsigned prog_gen = 0;             // generation of the program processed
+  void load_program();
+  long mark_last = DialBands::unset; // dial mark for the last raw value
+  bool first_reading = true;         // no readings processed yet
+  bool wait_for_commands = true;     // wait for commands to finish
+  bool wait_for_turn = false;        // no command until the mark changes
+  ReadingFilter filter;              // filters raw readings before marking
+  Oversampler oversampler;           // reduces bursts of raw readings
+  Timer timer;                       // time to stay on a mark before running
+  Counter still;                     // time since the mark last changed
+  long long raw_last = 0;            // last processed reading
+  timeval raw_last_time = {};        // sample time of the last reading
+  Counter since_first;               // time since the first reading
+  RollingSlope velocity;             // velocity of the last readings
+  double speed = 0;                  // speed of the last readings
+  double peak_speed = 0;             // highest speed since the mark changed
+  double peak_secs = 0;              // time of the highest speed
+  RollingStats settle_stats;         // variance of the last readings
+  RollingStats diff_stats;           // variance of the last differences
+  timeval turn_time = {};            // sample time of the last mark change
+  DialState cur;                     // state, published by publish_state()
+  void publish_state() { state.store(cur); }
+  CommandRunner runner;              // runs the commands
 };
 
 class Ads1x15 {
 private:
-  static const int num_channels_default = 4;
   mutable std::mutex adc_lock;
   iio_context *context = nullptr;
-  iio_device *device = nullptr;
   std::vector<std::unique_ptr<Dial>> dials;
+  std::vector<std::unique_ptr<IioAdc>> iio_adcs; // IIO devices in use
+  std::unique_ptr<Ads1x15I2c> i2c; // direct I2C access, instead of IIO
+  bool free_run = false;           // read without pausing
+  std::unique_ptr<Recorder> recorder; // records readings, if set
+  Counter run_time;                   // time since the program started
+  std::string realtime_desc;          // reading thread scheduling settings
+  std::atomic<bool> stop_groups{false}; // a group thread has failed
   void lock() const { adc_lock.lock(); }
   void unlock() const { adc_lock.unlock(); }
+  Status find_iio_adc(const std::string &name, IioAdc **adc);
+  Status run_groups(
+      const std::vector<std::vector<int>> &groups,
+      const std::function<Status(const std::vector<int> &)> &group_loop);
+  std::string monitor_line() const;
+  Status scan_channels(const std::vector<int> &idxs);
+  Status buffer_channels(const std::vector<int> &idxs,
+                         const iio_device *trigger, double trigger_freq);
 
 public:
+  static const int num_channels_default = 26; // channels a - z
+  static const int num_adc_channels = 4;      // ADS1X15 channels a - d
+
+  ~Ads1x15();
+
   static int channel_char_to_idx(char channel) { return channel - 'a'; }
   static char channel_idx_to_char(int idx) { return 'a' + idx; }
 
+  Status use_i2c(int bus, int address, const std::string &chip_name,
+                 int data_rate = 0);
   Status init(const DialSettings &default_settings,
               int num_channels = num_channels_default);
   Status read_config_file(const std::string &file_name,
                           const DialSettings &default_settings,
                           int num_channels = num_channels_default);
+  Status open_inputs();
+
+  /// Check whether a configuration was compiled into the program
+  /** A configuration is compiled in by configuring the build with
+   *  --with-builtin-config=FILE, where FILE was written by write_cpp().
+   * \return \c true if there is a builtin configuration. */
+  static bool has_builtin_config();
+
+  /// Get the name of the file the builtin configuration was read from
+  /**\return The file name, or an empty string if there is no builtin
+   *  configuration. */
+  static std::string builtin_config_name();
+
+  /// Set up the channels from the builtin configuration
+  /** Like read_config_file(), the inputs are then opened with open_inputs().
+   * \param default_settings settings that apply to all channels, before
+   *  the builtin settings
+   * \return status, evaluates to \c true if the channels were set up. */
+  Status init_builtin(const DialSettings &default_settings);
+
+  /// Write the configuration as a C++ header, for a builtin configuration
+  /** The header holds the settings, compiled bands and commands of each
+   *  enabled channel as constant data, with readings that the build
+   *  checks give the same marks as the configuration.
+   * \param file_name the file to write
+   * \param config_name the name of the configuration file
+   * \return status, evaluates to \c true if the file was written. */
+  Status write_cpp(const std::string &file_name,
+                   const std::string &config_name) const;
+  void set_free_run(bool flag = true) { free_run = flag; }
+
+  /// Set real-time scheduling for the threads that read the dials
+  /** Applies to the calling thread, and the threads it creates after the
+   *  call, so it should be called before the reading loop is started.
+   *  Commands run with normal scheduling on the CPUs the program had.
+   * \param priority the SCHED_FIFO priority 1 - 99, or 0 for no change
+   * \param lock_memory whether to lock the process memory into RAM
+   * \param cpus the CPUs to run on, or empty for no change
+   * \return status, evaluates to \c true if all the settings were made. */
+  Status set_realtime(int priority, bool lock_memory,
+                      const std::vector<int> &cpus);
+  Status record_to(const std::string &file_name);
   std::string config_report() const;
+  std::string schedule_report() const;
+
+  /// Get the state of every dial
+  /** The dials are not stopped while the states are collected. Unless a
+   *  dial is publishing states faster than they can be collected, the
+   *  states were all current at the same time.
+   * \return The states, by channel index. */
+  std::vector<DialState> get_dial_states() const;
+  void set_tracing(bool flag = true);
+  std::string trace_report() const;
+  void flush_recording();
 
-  Status read_raw(const std::string &attr, long long *raw);
+  std::string benchmark_report(int num_reads);
 
   Status start_loop();
   Status start_dial_loop(int channel);
+  Status start_buffer_loop(const std::string &trigger_name = "");
+  Status start_scan_loop();
+  Status start_event_loop(double monitor_freq = 0);
   Status monitor_loop(double frequency);
 
   Dial *get_dial(int idx) { return dials[idx].get(); }
@@ -0,0 +1,161 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file evdev_input.cpp
+   \brief Read a rotary encoder or other input device through evdev
+*/
+
+#include "evdev_input.h"
+#include "timer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace {
+bool test_bit(const unsigned long *bits, int bit)
+{
+  const int long_bits = sizeof(long) * 8;
+  return (bits[bit / long_bits] >> (bit % long_bits)) & 1;
+}
+}; // namespace
+
+EvdevInput::~EvdevInput()
+{
+  if (epoll_fd >= 0)
+    close(epoll_fd);
+  if (fd >= 0)
+    close(fd);
+}
+
+Status EvdevInput::init(const string &file_name, long scl, long min_p,
+                        long max_p)
+{
+  scale = scl;
+  min_pos = min_p;
+  max_pos = max_p;
+
+  fd = open(file_name.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return Status::error("could not open '" + file_name +
+                         "': " + strerror(errno));
+
+  // The device must report relative or absolute movement
+  const int long_bits = sizeof(long) * 8;
+  unsigned long ev_bits[EV_MAX / long_bits + 1] = {0};
+  unsigned long abs_bits[ABS_MAX / long_bits + 1] = {0};
+  if (ioctl(fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits) < 0)
+    return Status::error("'" + file_name + "' is not an input device");
+  if (test_bit(ev_bits, EV_ABS) &&
+      ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits) >= 0) {
+    for (int code = 0; code <= ABS_MAX && abs_code < 0; code++)
+      if (test_bit(abs_bits, code))
+        abs_code = code;
+  }
+  if (!test_bit(ev_bits, EV_REL) && abs_code < 0)
+    return Status::error("'" + file_name + "' does not report relative or "
+                                           "absolute movement");
+
+  // An absolute device starts at its current position
+  Status stat;
+  if (abs_code >= 0 && !(stat = read_abs_position()))
+    return stat;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    return Status::error(string("could not wait for input events: ") +
+                         strerror(errno));
+
+  char name[256] = "unknown";
+  ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+  description = "evdev '" + string(name) + "' (" + file_name + ")";
+  if (scale != 1)
+    description += msg_str(", scale %ld", scale);
+  return Status::ok();
+}
+
+Status EvdevInput::read_abs_position()
+{
+  input_absinfo abs_info;
+  if (ioctl(fd, EVIOCGABS(abs_code), &abs_info) < 0)
+    return Status::error(string("could not read input device position: ") +
+                         strerror(errno));
+  pos = abs_info.value;
+  return Status::ok();
+}
+
+Status EvdevInput::read(long long *raw, timeval *sample_time)
+{
+  // Apply all pending events, only the final position is used
+  input_event events[64];
+  ssize_t len;
+  while ((len = ::read(fd, events, sizeof(events))) > 0) {
+    for (size_t i = 0; i < len / sizeof(*events); i++) {
+      const auto &ev = events[i];
+      if (ev.type == EV_REL)
+        pos = std::min(std::max(pos + ev.value, (long long)min_pos),
+                       (long long)max_pos);
+      else if (ev.type == EV_ABS && ev.code == abs_code)
+        pos = ev.value;
+      else if (ev.type == EV_SYN && ev.code == SYN_DROPPED &&
+               abs_code >= 0) {
+        // Events were lost, the absolute position can be read again
+        Status stat = read_abs_position();
+        if (!stat)
+          return stat;
+      }
+    }
+  }
+  if (len < 0 && errno == ENODEV)
+    return Status::warning("input device removed");
+  if (len < 0 && errno != EAGAIN && errno != EINTR)
+    return Status::error(string("could not read input device: ") +
+                         strerror(errno));
+
+  *raw = pos * scale;
+  get_monotonic_time(sample_time);
+  return Status::ok();
+}
+
+Status EvdevInput::wait(double secs)
+{
+  const int msecs = wait_timeout_msecs(secs);
+  epoll_event ev;
+  if (epoll_wait(epoll_fd, &ev, 1, msecs) < 0 && errno != EINTR)
+    return Status::error(string("could not wait for input events: ") +
+                         strerror(errno));
+  return Status::ok();
+}
+
+string EvdevInput::get_description() const { return description; }
@@ -0,0 +1,79 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file evdev_input.h
+   \brief Read a rotary encoder or other input device through evdev
+*/
+
+#ifndef EVDEV_INPUT_H
+#define EVDEV_INPUT_H
+
+#include "input.h"
+#include "status_msg.h"
+
+#include <limits>
+#include <string>
+
+/// Input source reading the position of an evdev input device, such as a
+/// rotary encoder with the kernel \c rotary-encoder driver
+class EvdevInput : public InputSource {
+public:
+  /// Destructor, closes the device
+  ~EvdevInput();
+
+  /// Open the device
+  /**\param file_name the device file, e.g. \c /dev/input/event0
+   * \param scale the raw reading for one unit of position
+   * \param min_pos the lowest position, for relative movement
+   * \param max_pos the highest position, for relative movement
+   * \return status, evaluates to \c true if the device was opened. */
+  Status init(const std::string &file_name, long scale = 1,
+              long min_pos = std::numeric_limits<long>::min(),
+              long max_pos = std::numeric_limits<long>::max());
+
+  /// Read the current position
+  /** All pending events are applied, \c EV_REL events move the position
+   *  and \c EV_ABS events set the position.
+   * \param raw used to return the position multiplied by the scale
+   * \param sample_time used to return the current time
+   * \return status, evaluates to \c true if the reading was made. */
+  Status read(long long *raw, timeval *sample_time) override;
+  std::string get_description() const override;
+  int get_event_fd() const override { return fd; }
+  Status wait(double secs) override;
+
+private:
+  Status read_abs_position();
+
+  int fd = -1;           // input device file
+  int epoll_fd = -1;     // waits for events from the device
+  int abs_code = -1;     // absolute axis reported by the device, or -1
+  long long pos = 0;     // current position
+  long scale = 1;        // raw reading for one unit of position
+  long min_pos = std::numeric_limits<long>::min(); // lowest relative position
+  long max_pos = std::numeric_limits<long>::max(); // highest relative position
+  std::string description;
+};
+
+#endif // EVDEV_INPUT_H
@@ -0,0 +1,311 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file filter.cpp
+   \brief Filters to reduce the noise in raw dial readings
+*/
+
+#include "filter.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::string;
+
+Status ReadingFilter::init(const string &spec)
+{
+  num_stages = 0;
+  for (const auto &part : split(spec, ',')) {
+    auto words = split_words(part);
+    if (words.empty())
+      return Status::error("empty filter");
+    if (words[0] == "none" && words.size() == 1)
+      continue;
+    if (words.size() != 2)
+      return Status::error("filter '" + words[0] + "': give one parameter");
+    if (num_stages == max_stages)
+      return Status::error(msg_str("more than %d filters", max_stages));
+
+    Stage &stage = stages[num_stages];
+    string msg_prefix = "filter '" + words[0] + "': ";
+    Status stat = read_double(words[1].c_str(), &stage.param);
+    if (!stat)
+      return Status::error(msg_prefix + stat.msg());
+    if (words[0] == "median") {
+      stage.type = Type::median;
+      int size = stage.param;
+      if (size != stage.param || size < 3 || size > max_median_window ||
+          size % 2 == 0)
+        return Status::error(msg_str("%swindow must be an odd number from "
+                                     "3 to %d",
+                                     msg_prefix.c_str(), max_median_window));
+    }
+    else if (words[0] == "ema") {
+      stage.type = Type::ema;
+      if (stage.param <= 0 || stage.param > 1)
+        return Status::error(msg_prefix +
+                             "weight must be greater than 0, up to 1");
+    }
+    else if (words[0] == "slew") {
+      stage.type = Type::slew;
+      if (stage.param <= 0)
+        return Status::error(msg_prefix + "rate must be a positive number");
+    }
+    else
+      return Status::error("unknown filter '" + words[0] + "'");
+    num_stages++;
+  }
+
+  reset();
+  return Status::ok();
+}
+
+void ReadingFilter::reset()
+{
+  for (int i = 0; i < num_stages; i++) {
+    stages[i].count = 0;
+    stages[i].pos = 0;
+    stages[i].has_value = false;
+  }
+}
+
+long long ReadingFilter::apply(long long raw, const timeval &sample_time)
+{
+  double val = raw;
+  for (int i = 0; i < num_stages; i++) {
+    Stage &stage = stages[i];
+    if (stage.type == Type::median) {
+      const int size = stage.param;
+      stage.window[stage.pos] = std::llround(val);
+      stage.pos = (stage.pos + 1) % size;
+      stage.count = std::min(stage.count + 1, size);
+      // Select the middle reading from a copy, leaving the ring in order
+      std::array<long long, max_median_window> sorted;
+      std::copy_n(stage.window.begin(), stage.count, sorted.begin());
+      auto mid = sorted.begin() + stage.count / 2;
+      std::nth_element(sorted.begin(), mid, sorted.begin() + stage.count);
+      val = *mid;
+      continue;
+    }
+
+    if (!stage.has_value)
+      stage.value = val;
+    else if (stage.type == Type::ema)
+      stage.value += stage.param * (val - stage.value);
+    else { // slew
+      const double secs = (sample_time.tv_sec - stage.last_time.tv_sec) +
+                          (sample_time.tv_usec - stage.last_time.tv_usec) / 1e6;
+      const double max_step = stage.param * std::max(0.0, secs);
+      stage.value += std::max(-max_step, std::min(max_step, val - stage.value));
+    }
+    stage.has_value = true;
+    stage.last_time = sample_time;
+    val = stage.value;
+  }
+
+  return std::llround(val);
+}
+
+namespace {
+// The reducers work on contiguous 32-bit readings with no branches in
+// their inner loops, so that they vectorise (e.g. NEON or SSE/AVX)
+
+int64_t sum_samples(const int32_t *samples, int num)
+{
+  int64_t sum = 0;
+  for (int i = 0; i < num; i++)
+    sum += samples[i];
+  return sum;
+}
+
+long long mean_samples(const int32_t *samples, int num)
+{
+  return std::llround(double(sum_samples(samples, num)) / num);
+}
+
+long long trimmed_mean_samples(int32_t *samples, int num)
+{
+  // Drop the lowest and highest quarter of the readings, by partitioning
+  // them off either end
+  const int trim = num / 4;
+  if (trim > 0) {
+    std::nth_element(samples, samples + trim, samples + num);
+    std::nth_element(samples + trim, samples + num - trim, samples + num);
+  }
+  return mean_samples(samples + trim, num - 2 * trim);
+}
+
+long long median_samples(int32_t *samples, int num)
+{
+  auto mid = samples + num / 2;
+  std::nth_element(samples, mid, samples + num);
+  return *mid;
+}
+}; // namespace
+
+Status Oversampler::init(const string &spec)
+{
+  auto words = split_words(spec);
+  if (words.empty() || words.size() > 2)
+    return Status::error("give the number of readings, and optional reducer");
+
+  int num;
+  Status stat = read_int(words[0].c_str(), &num);
+  if (!stat)
+    return stat;
+  if (num < 1 || num > max_samples)
+    return Status::error(
+        msg_str("number of readings must be from 1 to %d", max_samples));
+
+  Reducer red = Reducer::mean;
+  if (words.size() > 1) {
+    if (words[1] == "trimmed")
+      red = Reducer::trimmed;
+    else if (words[1] == "median")
+      red = Reducer::median;
+    else if (words[1] != "mean")
+      return Status::error("unknown reducer '" + words[1] + "'");
+  }
+
+  num_samples = num;
+  reducer = red;
+  count = 0;
+  return Status::ok();
+}
+
+bool Oversampler::add(long long raw)
+{
+  // ADC readings fit in 32 bits, other values are clamped
+  raw = std::max<long long>(INT32_MIN, std::min<long long>(INT32_MAX, raw));
+  samples[count++] = raw;
+  return count >= num_samples;
+}
+
+long long Oversampler::reduce()
+{
+  const int num = count;
+  count = 0;
+  if (reducer == Reducer::trimmed)
+    return trimmed_mean_samples(samples.data(), num);
+  else if (reducer == Reducer::median)
+    return median_samples(samples.data(), num);
+  else
+    return mean_samples(samples.data(), num);
+}
+
+void RollingStats::set_window(int window_size)
+{
+  size = std::max(2, std::min(max_window, window_size));
+  reset();
+}
+
+void RollingStats::reset()
+{
+  count = 0;
+  pos = 0;
+  mean = 0;
+  m2 = 0;
+}
+
+void RollingStats::add(double val)
+{
+  if (count == size) { // remove the oldest reading, at the next position
+    const double old = ring[pos];
+    const double delta = old - mean;
+    mean -= delta / (count - 1);
+    m2 -= delta * (old - mean);
+    count--;
+  }
+
+  ring[pos] = val;
+  pos = (pos + 1) % size;
+  count++;
+  const double delta = val - mean;
+  mean += delta / count;
+  m2 += delta * (val - mean);
+  if (pos == 0 && count == size)
+    recalculate(); // once for each full window
+}
+
+void RollingStats::recalculate()
+{
+  double sum = 0;
+  for (int i = 0; i < count; i++)
+    sum += ring[i];
+  mean = sum / count;
+  m2 = 0;
+  for (int i = 0; i < count; i++)
+    m2 += (ring[i] - mean) * (ring[i] - mean);
+}
+
+double RollingStats::range() const
+{
+  if (count == 0)
+    return 0;
+  auto minmax = std::minmax_element(ring.begin(), ring.begin() + count);
+  return *minmax.second - *minmax.first;
+}
+
+void RollingSlope::set_window(int window_size)
+{
+  size = std::max(2, std::min(max_window, window_size));
+  reset();
+}
+
+void RollingSlope::reset()
+{
+  count = 0;
+  pos = 0;
+}
+
+void RollingSlope::add(double secs, double val)
+{
+  times[pos] = secs;
+  vals[pos] = val;
+  pos = (pos + 1) % size;
+  count = std::min(count + 1, size);
+}
+
+double RollingSlope::slope() const
+{
+  if (count < 2)
+    return 0;
+  double t_mean = 0;
+  double v_mean = 0;
+  for (int i = 0; i < count; i++) {
+    t_mean += times[i];
+    v_mean += vals[i];
+  }
+  t_mean /= count;
+  v_mean /= count;
+  double tt = 0;
+  double tv = 0;
+  for (int i = 0; i < count; i++) {
+    const double dt = times[i] - t_mean;
+    tt += dt * dt;
+    tv += dt * (vals[i] - v_mean);
+  }
+  return (tt > 0) ? tv / tt : 0;
+}
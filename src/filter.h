@@ -0,0 +1,211 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file filter.h
+   \brief Filters to reduce the noise in raw dial readings
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "status_msg.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <sys/time.h>
+
+/// A pipeline of noise filters for the raw readings of a dial
+/** The filters are applied in turn to each reading. Their state is kept
+ *  in fixed size arrays, so filtering a reading does not allocate memory. */
+class ReadingFilter {
+public:
+  static const int max_stages = 8;         ///< most filters in a pipeline
+  static const int max_median_window = 31; ///< most readings for a median
+
+  /// Set the filters from a specification
+  /**\param spec comma separated filters, each one of
+   *  - median n - the median of the last n readings (odd, 3 - 31)
+   *  - ema alpha - exponential moving average, weighting each new reading
+   *    by alpha (0 - 1)
+   *  - slew rate - limit the change to rate units per second
+   *  - none - no filter, the reading is unchanged
+   * \return status, evaluates to \c true if the specification was valid. */
+  Status init(const std::string &spec);
+
+  /// Check whether there are any filters
+  /**\return \c true if there are filters, otherwise \c false. */
+  bool is_set() const { return num_stages > 0; }
+
+  /// Clear the filter state, so the next reading starts the filters again
+  void reset();
+
+  /// Filter a reading
+  /**\param raw the raw reading
+   * \param sample_time the time the reading was taken, on the monotonic
+   *  clock
+   * \return The filtered reading. */
+  long long apply(long long raw, const timeval &sample_time);
+
+private:
+  enum class Type { median, ema, slew };
+  struct Stage {
+    Type type;
+    double param; // window size, weight, or units per second
+    // median state, a ring buffer of the last readings
+    std::array<long long, max_median_window> window;
+    int count; // number of readings in the window
+    int pos;   // position in the window for the next reading
+    // ema and slew state
+    double value;      // current output value
+    bool has_value;    // whether there has been a reading
+    timeval last_time; // time of the last reading
+  };
+
+  std::array<Stage, max_stages> stages;
+  int num_stages = 0;
+};
+
+/// Reduce a burst of raw readings to a single reading
+/** The burst readings are kept in a fixed size array, and reduced with
+ *  simple loops over the array that the compiler can vectorise. */
+class Oversampler {
+public:
+  static const int max_samples = 256; ///< most readings in a burst
+
+  /// Set the burst size and reducer from a specification
+  /**\param spec the number of readings in a burst (1 - 256, 1 for no
+   *  oversampling), optionally followed by the reducer, one of
+   *  - mean - mean of the readings (default)
+   *  - trimmed - mean of the middle half of the readings
+   *  - median - median of the readings
+   * \return status, evaluates to \c true if the specification was valid. */
+  Status init(const std::string &spec);
+
+  /// Check whether readings are oversampled
+  /**\return \c true if a burst has more than one reading. */
+  bool is_set() const { return num_samples > 1; }
+
+  /// Get the number of readings in a burst
+  /**\return The number of readings. */
+  int get_num_samples() const { return num_samples; }
+
+  /// Add a reading to the burst
+  /**\param raw the raw reading
+   * \return \c true if the burst is complete. */
+  bool add(long long raw);
+
+  /// Reduce the complete burst to one reading, and start a new burst
+  /**\return The reduced reading. */
+  long long reduce();
+
+private:
+  enum class Reducer { mean, trimmed, median };
+  Reducer reducer = Reducer::mean;
+  int num_samples = 1;
+  int count = 0;
+  std::array<int32_t, max_samples> samples;
+};
+
+/// Variance and range of the last readings in a window
+/** The mean and variance are updated with Welford's algorithm as each
+ *  reading enters the window and the oldest leaves, and the readings are
+ *  kept in a fixed size ring buffer. Removing readings lets rounding
+ *  errors build up, so the mean and variance are found again from the
+ *  readings once for each full window. */
+class RollingStats {
+public:
+  static const int max_window = 64; ///< most readings in the window
+
+  /// Set the number of readings in the window, and clear the readings
+  /**\param size the number of readings, 2 - max_window. */
+  void set_window(int size);
+
+  /// Clear the readings
+  void reset();
+
+  /// Add a reading, removing the oldest reading if the window is full
+  /**\param val the reading. */
+  void add(double val);
+
+  /// Check whether the window is full
+  /**\return \c true if the window holds its number of readings. */
+  bool is_full() const { return count == size; }
+
+  /// Get the variance of the readings in the window
+  /**\return The population variance. */
+  double variance() const { return count ? std::max(0.0, m2 / count) : 0; }
+
+  /// Get the range of the readings in the window
+  /**\return The highest reading minus the lowest reading. */
+  double range() const;
+
+private:
+  std::array<double, max_window> ring;
+  int size = 2;    // number of readings in a full window
+  int count = 0;   // number of readings in the window
+  int pos = 0;     // position in the ring for the next reading
+  double mean = 0; // mean of the readings
+  double m2 = 0;   // sum of squared differences from the mean
+  void recalculate();
+};
+
+/// Rate of change of the last readings in a window
+/** The rate is the slope of the least squares line through the readings
+ *  and their times, so the noise of single readings is averaged over the
+ *  window. */
+class RollingSlope {
+public:
+  static const int max_window = RollingStats::max_window; ///< most readings
+
+  /// Set the number of readings in the window, and clear the readings
+  /**\param size the number of readings, 2 - max_window. */
+  void set_window(int size);
+
+  /// Clear the readings
+  void reset();
+
+  /// Add a reading, removing the oldest reading if the window is full
+  /**\param secs the time of the reading, in seconds from any fixed time
+   * \param val the reading. */
+  void add(double secs, double val);
+
+  /// Check whether the window is full
+  /**\return \c true if the window holds its number of readings. */
+  bool is_full() const { return count == size; }
+
+  /// Get the rate of change of the readings in the window
+  /**\return The change per second, or 0 if the rate is not known. */
+  double slope() const;
+
+private:
+  std::array<double, max_window> times;
+  std::array<double, max_window> vals;
+  int size = 2;  // number of readings in a full window
+  int count = 0; // number of readings in the window
+  int pos = 0;   // position in the ring for the next reading
+};
+
+#endif // FILTER_H
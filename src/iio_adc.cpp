@@ -0,0 +1,259 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file iio_adc.cpp
+   \brief Read voltage channels of an ADC through its IIO kernel driver
+*/
+
+#include "iio_adc.h"
+#include "timer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <linux/iio/events.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace {
+// Parse an integer from a sysfs value, without locale or allocation
+bool parse_sysfs_int(const char *p, const char *end, long long *val)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  bool neg = (p < end && *p == '-');
+  if (neg || (p < end && *p == '+'))
+    p++;
+  if (p == end || *p < '0' || *p > '9')
+    return false;
+  long long v = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    v = v * 10 + (*p - '0');
+  *val = neg ? -v : v;
+  return true;
+}
+
+string raw_attr_name(int chan)
+{
+  return "in_voltage" + std::to_string(chan) + "_raw";
+}
+}; // namespace
+
+IioAdc::~IioAdc()
+{
+  for (auto kp : raw_fds)
+    if (kp.second >= 0)
+      close(kp.second);
+  if (event_fd >= 0)
+    close(event_fd);
+}
+
+string IioAdc::get_id() const { return iio_device_get_id(device); }
+
+string IioAdc::get_description() const
+{
+  const char *name = iio_device_get_name(device);
+  return string(name ? name : "unnamed") + " (" + get_id() + ")";
+}
+
+Status IioAdc::open_channel(int chan)
+{
+  string chan_id = "voltage" + std::to_string(chan);
+  if (iio_device_find_channel(device, chan_id.c_str(), false) == nullptr)
+    return Status::error("IIO device " + get_description() + " has no " +
+                         chan_id + " channel");
+
+  if (raw_fds.find(chan) == raw_fds.end()) {
+    string path =
+        "/sys/bus/iio/devices/" + get_id() + "/" + raw_attr_name(chan);
+    raw_fds[chan] = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  }
+
+  return Status::ok();
+}
+
+bool IioAdc::has_raw_file(int chan) const
+{
+  auto it = raw_fds.find(chan);
+  return it != raw_fds.end() && it->second >= 0;
+}
+
+Status IioAdc::read_raw_attr(int chan, long long *raw)
+{
+  const string attr = raw_attr_name(chan);
+  lock.lock();
+  auto adc_read_ret = iio_device_attr_read_longlong(device, attr.c_str(), raw);
+  lock.unlock();
+
+  if (adc_read_ret != 0)
+    return Status::error("could not read values from " + get_description() +
+                         " from " + attr);
+  return Status::ok();
+}
+
+Status IioAdc::read_raw(int chan, long long *raw)
+{
+  // Fast path: reread the sysfs file that was opened in open_channel()
+  auto it = raw_fds.find(chan);
+  if (it == raw_fds.end() || it->second < 0)
+    return read_raw_attr(chan, raw);
+
+  char buf[32];
+  lock.lock();
+  auto len = pread(it->second, buf, sizeof(buf), 0);
+  lock.unlock();
+
+  if (len <= 0 || !parse_sysfs_int(buf, buf + len, raw))
+    return Status::error("could not read values from " + get_description() +
+                         " from " + raw_attr_name(chan));
+  return Status::ok();
+}
+
+Status IioAdc::open_event_file()
+{
+  if (event_fd >= 0)
+    return Status::ok();
+
+  string dev_name = "/dev/" + get_id();
+  int dev_fd = open(dev_name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (dev_fd < 0)
+    return Status::error("could not open " + dev_name + ": " + strerror(errno));
+
+  int fd;
+  int ret = ioctl(dev_fd, IIO_GET_EVENT_FD_IOCTL, &fd);
+  close(dev_fd);
+  if (ret < 0)
+    return Status::error(string("could not get IIO event file: ") +
+                         strerror(errno));
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  event_fd = fd;
+  return Status::ok();
+}
+
+Status IioAdc::set_event_attr(int chan, const string &name, long long val)
+{
+  string path = "/sys/bus/iio/devices/" + get_id() + "/events/in_voltage" +
+                std::to_string(chan) + "_" + name;
+  string val_str = std::to_string(val);
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return Status::error("could not open " + path + ": " + strerror(errno));
+  auto len = write(fd, val_str.c_str(), val_str.size());
+  int err = errno;
+  close(fd);
+  if (len != (ssize_t)val_str.size())
+    return Status::error("could not write " + path + ": " + strerror(err));
+  return Status::ok();
+}
+
+Status IioAdc::wait_for_event(int chan, long low, long high)
+{
+  lock.lock();
+  Status stat = open_event_file();
+  lock.unlock();
+  if (!stat)
+    return stat;
+
+  // Threshold limits come from the number of bits in a reading
+  int bits = 16;
+  string chan_id = "voltage" + std::to_string(chan);
+  auto iio_chan = iio_device_find_channel(device, chan_id.c_str(), false);
+  if (iio_chan != nullptr) {
+    const auto fmt = iio_channel_get_data_format(iio_chan);
+    if (fmt != nullptr && fmt->bits > 1)
+      bits = fmt->bits;
+  }
+  const long val_max = (1L << (bits - 1)) - 1;
+  const long val_min = -val_max - 1;
+
+  // The window comparator triggers above the rising value or below the
+  // falling value
+  long rising = (high == std::numeric_limits<long>::max()) ? val_max : high - 1;
+  long falling = (low == std::numeric_limits<long>::min()) ? val_min : low;
+  rising = std::min(std::max(rising, val_min), val_max);
+  falling = std::min(std::max(falling, val_min), val_max);
+  if (!(stat = set_event_attr(chan, "thresh_rising_value", rising)) ||
+      !(stat = set_event_attr(chan, "thresh_falling_value", falling)))
+    return stat;
+
+  lock.lock();
+  events_seen.erase(chan);
+  lock.unlock();
+
+  // The ADS1X15 driver enables both directions together, other drivers
+  // (e.g. iio_dummy) enable each direction
+  const bool either_en = set_event_attr(chan, "thresh_either_en", 1).is_ok();
+  if (!either_en && (!(stat = set_event_attr(chan, "thresh_rising_en", 1)) ||
+                     !(stat = set_event_attr(chan, "thresh_falling_en", 1))))
+    return Status::error("could not enable threshold events: " + stat.msg());
+
+  while (true) {
+    // The reading may have left the range before the events were enabled,
+    // and is also rechecked if there is no event for a long time
+    long long raw;
+    if (!(stat = read_raw(chan, &raw)) || raw < falling || raw > rising)
+      break;
+
+    pollfd pfd = {event_fd, POLLIN, 0};
+    poll(&pfd, 1, 60 * 1000);
+
+    // Threads waiting on different channels share the event file
+    lock.lock();
+    iio_event_data event;
+    while (read(event_fd, &event, sizeof(event)) == sizeof(event))
+      events_seen.insert(IIO_EVENT_CODE_EXTRACT_CHAN(event.id));
+    const bool seen = events_seen.erase(chan);
+    lock.unlock();
+    if (seen)
+      break;
+  }
+
+  if (either_en)
+    set_event_attr(chan, "thresh_either_en", 0);
+  else {
+    set_event_attr(chan, "thresh_rising_en", 0);
+    set_event_attr(chan, "thresh_falling_en", 0);
+  }
+
+  return stat;
+}
+
+Status IioInput::read(long long *raw, timeval *sample_time)
+{
+  auto stat = adc->read_raw(chan, raw);
+  get_monotonic_time(sample_time);
+  return stat;
+}
+
+string IioInput::get_description() const
+{
+  return msg_str("%s channel %d", adc->get_description().c_str(), chan);
+}
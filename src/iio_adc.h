@@ -0,0 +1,126 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file iio_adc.h
+   \brief Read voltage channels of an ADC through its IIO kernel driver
+*/
+
+#ifndef IIO_ADC_H
+#define IIO_ADC_H
+
+#include "input.h"
+#include "status_msg.h"
+
+#include <iio.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+/// An IIO voltage device, shared by the channels that read from it
+class IioAdc {
+public:
+  /// Constructor
+  /**\param device the IIO device */
+  explicit IioAdc(iio_device *device) : device(device) {}
+
+  /// Destructor, closes any open files
+  ~IioAdc();
+
+  /// Get the IIO device
+  /**\return The device. */
+  iio_device *get_device() const { return device; }
+
+  /// Get the device id
+  /**\return The id, e.g. \c "iio:device0". */
+  std::string get_id() const;
+
+  /// Get a description of the device
+  /**\return The device name and id. */
+  std::string get_description() const;
+
+  /// Check a voltage channel exists, and open its raw value file
+  /**\param chan the channel number (as in \c in_voltageN_raw)
+   * \return status, evaluates to \c true if the channel exists. */
+  Status open_channel(int chan);
+
+  /// Read a raw value, rereading the sysfs file opened in open_channel(),
+  /// or if it could not be opened then with libiio.
+  /**\param chan the channel number
+   * \param raw used to return the reading
+   * \return status, evaluates to \c true if the reading was made. */
+  Status read_raw(int chan, long long *raw);
+
+  /// Read a raw value through the libiio attribute interface
+  /**\param chan the channel number
+   * \param raw used to return the reading
+   * \return status, evaluates to \c true if the reading was made. */
+  Status read_raw_attr(int chan, long long *raw);
+
+  /// Check whether the raw value file for a channel is open
+  /**\param chan the channel number
+   * \return \c true if the file is open, otherwise \c false. */
+  bool has_raw_file(int chan) const;
+
+  /// Sleep until a reading leaves a range, using the threshold events
+  /**\param chan the channel number
+   * \param low the lowest reading in the range, or
+   *  \c std::numeric_limits<long>::min()
+   * \param high one more than the highest reading in the range, or
+   *  \c std::numeric_limits<long>::max()
+   * \return status, evaluates to \c true if the reading has left the
+   *  range, otherwise threshold events could not be used. */
+  Status wait_for_event(int chan, long low, long high);
+
+private:
+  Status open_event_file();
+  Status set_event_attr(int chan, const std::string &name, long long val);
+
+  iio_device *device;          // the device
+  std::mutex lock;             // the device converts one channel at a time
+  std::map<int, int> raw_fds;  // open raw value sysfs files, -1 if not open
+  int event_fd = -1;           // IIO event file, -1 if not open
+  std::set<int> events_seen;   // channels with unhandled threshold events
+};
+
+/// Input source reading a voltage channel of an IIO device
+class IioInput : public InputSource {
+public:
+  /// Constructor
+  /**\param adc the device
+   * \param chan the channel number */
+  IioInput(IioAdc *adc, int chan) : adc(adc), chan(chan) {}
+  Status read(long long *raw, timeval *sample_time) override;
+  std::string get_description() const override;
+  const void *get_device() const override { return adc; }
+  IioAdc *get_adc() const { return adc; }
+  int get_channel() const { return chan; }
+
+private:
+  IioAdc *adc;
+  int chan;
+};
+
+#endif // IIO_ADC_H
@@ -0,0 +1,259 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file input.cpp
+   \brief Sources of raw dial readings
+*/
+
+#include "input.h"
+#include "datagram_input.h"
+#include "evdev_input.h"
+#include "record.h"
+#include "timer.h"
+#include "utils.h"
+
+#include <cmath>
+
+using std::string;
+using std::vector;
+
+int wait_timeout_msecs(double secs)
+{
+  const double max_secs = 24 * 60 * 60;
+  return (secs < 0 || secs > max_secs) ? max_secs * 1000
+                                       : std::ceil(secs * 1000);
+}
+
+Status SimInput::init(const vector<string> &params, double frequency,
+                      bool free_running)
+{
+  period = 1 / frequency;
+  free_run = free_running;
+  description = "sim " + join(params.begin(), params.end());
+
+  vector<double> nums;
+  size_t end = params.size();
+  if (end >= 2 && params[end - 2] == "noise") {
+    Status stat = read_double(params[end - 1].c_str(), &noise);
+    if (!stat)
+      return Status::error("noise amplitude: " + stat.msg());
+    end -= 2;
+  }
+  if (end == 0)
+    return Status::error("no waveform given");
+
+  for (size_t i = 1; i < end; i++) {
+    double num;
+    Status stat = read_double(params[i].c_str(), &num);
+    if (!stat)
+      return Status::error("'" + params[i] + "': " + stat.msg());
+    nums.push_back(num);
+  }
+
+  const string &wave_name = params[0];
+  if (wave_name == "const") {
+    if (nums.size() != 1)
+      return Status::error("const: give one value");
+    wave = Wave::constant;
+    vals = nums;
+  }
+  else if (wave_name == "ramp") {
+    if (nums.size() != 3)
+      return Status::error("ramp: give start, end and seconds");
+    wave = Wave::ramp;
+    vals = {nums[0], nums[1]};
+    secs = nums[2];
+  }
+  else if (wave_name == "steps") {
+    if (nums.size() < 2)
+      return Status::error("steps: give seconds and at least one value");
+    wave = Wave::steps;
+    secs = nums[0];
+    vals.assign(nums.begin() + 1, nums.end());
+  }
+  else
+    return Status::error("unknown waveform '" + wave_name + "'");
+
+  if (secs <= 0)
+    return Status::error("seconds must be positive");
+
+  return Status::ok();
+}
+
+Status SimInput::read(long long *raw, timeval *sample_time)
+{
+  timeval now;
+  get_monotonic_time(&now);
+  if (count == 0)
+    start = now;
+
+  double t; // seconds since start
+  if (free_run) {
+    t = count * period;
+    now.tv_sec = start.tv_sec + long(t);
+    now.tv_usec = start.tv_usec + long((t - long(t)) * 1000000);
+    if (now.tv_usec >= 1000000) {
+      now.tv_sec++;
+      now.tv_usec -= 1000000;
+    }
+  }
+  else
+    t = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+  count++;
+
+  double val;
+  if (wave == Wave::ramp) {
+    double frac = fmod(t, secs) / secs;
+    val = vals[0] + frac * (vals[1] - vals[0]);
+  }
+  else if (wave == Wave::steps)
+    val = vals[long(t / secs) % vals.size()];
+  else
+    val = vals[0];
+
+  if (noise > 0)
+    val += noise * (2.0 * rand_gen() / rand_gen.max() - 1);
+
+  *raw = std::llround(val);
+  *sample_time = now;
+  return Status::ok();
+}
+
+string SimInput::get_description() const { return description; }
+
+Status check_input_spec(const string &spec)
+{
+  auto words = split_words(spec);
+  if (words.empty())
+    return Status::error("no input type given");
+
+  const vector<string> params(words.begin() + 1, words.end());
+  if (words[0] == "adc") {
+    if (params.size() > 0)
+      return Status::error("adc: input does not take parameters");
+  }
+  else if (words[0] == "iio") {
+    int chan;
+    if (params.size() != 2)
+      return Status::error("iio: give a device name or id, and a channel");
+    if (!read_int(params[1].c_str(), &chan) || chan < 0)
+      return Status::error("iio: invalid channel number '" + params[1] + "'");
+  }
+  else if (words[0] == "evdev") {
+    vector<int> vals(params.size());
+    if (params.size() != 1 && params.size() != 2 && params.size() != 4)
+      return Status::error("evdev: give a device file, and optional scale, "
+                           "or scale, minimum and maximum position");
+    for (size_t i = 1; i < params.size(); i++)
+      if (!read_int(params[i].c_str(), &vals[i]))
+        return Status::error("evdev: invalid number '" + params[i] + "'");
+    if (params.size() == 4 && vals[2] > vals[3])
+      return Status::error("evdev: minimum position is greater than maximum");
+  }
+  else if (words[0] == "udp" || words[0] == "unix") {
+    if (params.size() != 1)
+      return Status::error(words[0] + ": give a " +
+                           (words[0] == "udp" ? "[address:]port"
+                                              : "socket file name"));
+  }
+  else if (words[0] == "sim") {
+    SimInput sim;
+    Status stat = sim.init(params, 10, false);
+    if (!stat)
+      return Status::error("sim: " + stat.msg());
+  }
+  else if (words[0] == "replay") {
+    if (params.size() < 1 || params.size() > 2)
+      return Status::error("replay: give a file name and optional channel");
+    if (params.size() == 2 &&
+        (params[1].size() != 1 || params[1][0] < 'a' || params[1][0] > 'z'))
+      return Status::error("replay: invalid channel letter '" + params[1] +
+                           "'");
+  }
+  else
+    return Status::error("unknown input type '" + words[0] + "'");
+
+  return Status::ok();
+}
+
+Status make_input(const string &spec, int idx, double frequency,
+                  bool free_run, std::unique_ptr<InputSource> *input)
+{
+  Status stat = check_input_spec(spec);
+  if (!stat)
+    return stat;
+
+  auto words = split_words(spec);
+  const vector<string> params(words.begin() + 1, words.end());
+  if (words[0] == "sim") {
+    auto sim = std::make_unique<SimInput>();
+    sim->init(params, frequency, free_run);
+    *input = std::move(sim);
+  }
+  else if (words[0] == "evdev") {
+    vector<int> vals(params.size());
+    for (size_t i = 1; i < params.size(); i++)
+      read_int(params[i].c_str(), &vals[i]);
+    auto evdev = std::make_unique<EvdevInput>();
+    if (params.size() == 4)
+      stat = evdev->init(params[0], vals[1], vals[2], vals[3]);
+    else
+      stat = evdev->init(params[0], (params.size() > 1) ? vals[1] : 1);
+    if (!stat)
+      return Status::error("evdev: " + stat.msg());
+    *input = std::move(evdev);
+  }
+  else if (words[0] == "udp" || words[0] == "unix") {
+    auto datagram = std::make_unique<DatagramInput>();
+    if (words[0] == "unix")
+      stat = datagram->init_unix(params[0]);
+    else {
+      // [address:]port, where an IPv6 address may be in brackets
+      string address, port = params[0];
+      auto pos = params[0].rfind(':');
+      if (pos != string::npos) {
+        address = params[0].substr(0, pos);
+        port = params[0].substr(pos + 1);
+        if (address.size() > 1 && address.front() == '[' &&
+            address.back() == ']')
+          address = address.substr(1, address.size() - 2);
+      }
+      stat = datagram->init_udp(address, port);
+    }
+    if (!stat)
+      return Status::error(words[0] + ": " + stat.msg());
+    *input = std::move(datagram);
+  }
+  else if (words[0] == "replay") {
+    int channel = (params.size() == 2) ? params[1][0] - 'a' : idx;
+    auto replay = std::make_unique<ReplayInput>();
+    if (!(stat = replay->init(params[0], channel, free_run)))
+      return Status::error("replay: " + stat.msg());
+    *input = std::move(replay);
+  }
+  else
+    return Status::error("input type '" + words[0] + "' cannot be created");
+
+  return Status::ok();
+}
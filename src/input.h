@@ -0,0 +1,150 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file input.h
+   \brief Sources of raw dial readings
+*/
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "status_msg.h"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+/// A source of raw dial readings
+class InputSource {
+public:
+  /// Destructor
+  virtual ~InputSource() = default;
+
+  /// Read the next raw value
+  /**\param raw used to return the reading
+   * \param sample_time used to return the time the reading was taken
+   * \return status, evaluates to \c true if a reading was made. */
+  virtual Status read(long long *raw, timeval *sample_time) = 0;
+
+  /// Read the next raw value, if it can be read without waiting
+  /** A source that waits in read() until it has a first reading returns
+   *  without a reading instead.
+   * \param raw used to return the reading
+   * \param sample_time used to return the time the reading was taken
+   * \param has_read used to return whether a reading was made
+   * \return status, evaluates to \c true unless the read failed. */
+  virtual Status read_no_wait(long long *raw, timeval *sample_time,
+                              bool *has_read)
+  {
+    Status stat = read(raw, sample_time);
+    *has_read = stat.is_ok();
+    return stat;
+  }
+
+  /// Get a description of the source
+  /**\return The description */
+  virtual std::string get_description() const = 0;
+
+  /// Get the device the source reads from
+  /** Sources that read from the same device are scheduled together.
+   * \return The device, or \c nullptr if the source is independent. */
+  virtual const void *get_device() const { return nullptr; }
+
+  /// Get a file that is readable when the source has a new reading
+  /**\return The file descriptor, or -1 if the source must be polled. */
+  virtual int get_event_fd() const { return -1; }
+
+  /// Check whether the source signals new readings
+  /**\return \c true if wait() returns when there is a new reading, or
+   *  \c false if the source must be polled. */
+  bool is_event_driven() const { return get_event_fd() >= 0; }
+
+  /// Wait for a new reading, for a source that is event driven
+  /**\param secs the longest time to wait, or a negative value to wait
+   *  until there is a new reading
+   * \return status, evaluates to \c true unless the wait failed. */
+  virtual Status wait(double /*secs*/) { return Status::ok(); }
+};
+
+/// Simulated readings from a scripted waveform, with optional noise
+class SimInput : public InputSource {
+public:
+  /// Initialise from parameters
+  /**\param params the waveform parameters, one of
+   *   \c ramp \c start \c end \c secs - repeated ramp from start to end
+   *   \c steps \c secs \c val1 \c [val2...] - hold each value for secs
+   *   \c const \c val - a constant value
+   *  optionally followed by \c noise \c amplitude to add uniform noise
+   * \param frequency readings per second
+   * \param free_run if \c true then each reading is one period after the
+   *  previous one in simulated time, otherwise the current time is used
+   * \return status, evaluates to \c true if the parameters were valid. */
+  Status init(const std::vector<std::string> &params, double frequency,
+              bool free_run);
+
+  Status read(long long *raw, timeval *sample_time) override;
+  std::string get_description() const override;
+
+private:
+  enum class Wave { constant, ramp, steps };
+  Wave wave = Wave::constant;
+  std::vector<double> vals;        // ramp start and end, or step values
+  double secs = 1;                 // ramp or step time
+  double noise = 0;                // noise amplitude
+  double period = 0;               // time between readings when free running
+  bool free_run = false;           // use simulated time
+  long long count = 0;             // number of readings made
+  timeval start;                   // time of the first reading
+  std::minstd_rand rand_gen;       // repeatable noise
+  std::string description;
+};
+
+/// Create an input source that does not read an ADC
+/**\param spec the input type followed by its parameters, separated by
+ *  whitespace, e.g. \c "sim ramp 0 26000 10"
+ * \param idx index of the channel the input is for
+ * \param frequency readings per second
+ * \param free_run whether readings are taken without pausing, and
+ *  simulated sources should use simulated time
+ * \param input used to return the input source
+ * \return status, evaluates to \c true if the input source was created. */
+Status make_input(const std::string &spec, int idx, double frequency,
+                  bool free_run, std::unique_ptr<InputSource> *input);
+
+/// Get the timeout for an InputSource::wait()
+/** Waits are at most one day, the reading is checked again after any
+ *  timeout.
+ * \param secs the longest time to wait, or a negative value to wait until
+ *  there is a new reading
+ * \return The timeout in milliseconds, for \c poll() or \c epoll_wait(). */
+int wait_timeout_msecs(double secs);
+
+/// Check the syntax of an input specification, without opening any source
+/**\param spec the input specification (see make_input())
+ * \return status, evaluates to \c true if the specification is valid. */
+Status check_input_spec(const std::string &spec);
+
+#endif // INPUT_H
@@ -30,7 +30,9 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <csignal>
 #include <limits>
+#include <pthread.h>
 #include <string>
 #include <thread>
 #include <vector>
@@ -41,9 +43,29 @@ class DialOpts : public ProgramOpts {
 public:
   DialSettings dial_settings;
   std::string config_file_name = "/etc/turnandrun.conf"; // config file name
+  bool config_file_set = false; // config file name given with -c
+  std::string cpp_file_name;    // file to write the config as C++ to
   bool dry_run = false;
   bool report = false;
+  bool trace = false;
+  bool free_run = false;
+  std::string record_file_name; // file to record readings to
   double monitor_freq = 0;
+  std::string acquisition = "threads"; // acquisition mode
+  std::string trigger_name;            // IIO trigger for buffered reads
+  int benchmark_reads = 0;             // number of reads for benchmark
+  bool use_i2c = false;                // access ADC directly with i2c-dev
+  int i2c_bus = 1;
+  int i2c_address = 0x48;
+  std::string i2c_chip = "ads1115";
+  int i2c_data_rate = 0; // chip default
+  int rt_priority = 0;         // SCHED_FIFO priority, 0 for normal
+  bool lock_memory = false;    // lock process memory into RAM
+  std::vector<int> cpus;       // CPUs for reading threads, empty for any
+
+  void read_cpus(const char *arg);
+
+  void read_interface(const char *arg);
 
   DialOpts() : ProgramOpts("turnandrun", "0.02") {}
   void process_command_line(int argc, char **argv);
@@ -61,20 +83,93 @@ positions.
 
 Options
 %s
-  -c <file>  configuration file name (default: /etc/turnandrun.conf)
+  -c <file>  configuration file name (default: /etc/turnandrun.conf, or
+             the builtin configuration if the program has one, see -E)
              Format
-               One to four sections, each section starting CHANNEL followed
-               by a letter a, b, c, d (corresponding to the ADS1X15 channel
-               used for the readings)
+               One or more sections, each section starting CHANNEL followed
+               by a letter a - z (a - d correspond to the ADS1X15 channels
+               read with the default input)
                     e.g. CHANNEL a
 
                The section heading is followed by settings lines
+                 input = type [params]        (default: adc)
+                    adc - the ADS1X15 channel for the section letter a - d
+                      (read through the -i interface)
+                    iio device channel - voltage channel number of any IIO
+                      ADC, where device is the IIO device name or id
+                    e.g. input = iio iio:device1 2
+                    e.g. input = iio mcp3008 5
+                    evdev file [scale [min max]] - position of an input
+                      device, e.g. a rotary encoder, multiplied by scale
+                      (default: 1), where relative movement is limited to
+                      positions min to max. Readings are made on events
+                    e.g. input = evdev /dev/input/event0 1000 0 26
+                    udp [address:]port - readings received as datagrams
+                      on a UDP port, each containing a number as text
+                    e.g. input = udp 127.0.0.1:5000
+                    unix file - readings received as datagrams on a Unix
+                      socket
+                    e.g. input = unix /run/turnandrun/dial_e.sock
+                    sim wave [noise amplitude] - simulated readings, where
+                      wave is one of
+                        ramp start end secs - repeating ramp
+                        steps secs val1 [val2...] - hold each value in turn
+                        const val - constant value
+                    e.g. input = sim steps 2 0 8000 16000 noise 50
+                    replay file [letter] - readings from a recording file
+                      (see -w) for the section letter, or the letter given
+                    e.g. input = replay /tmp/dials.rec b
+                 oversample = num [reducer]   (default: 1, range: 1 - 256)
+                    make a burst of num readings for each reading (adc,
+                    iio and sim inputs) and reduce them to one value with
+                    reducer mean (default), trimmed (mean of the middle
+                    half) or median
+                    e.g. oversample = 8 trimmed
+                 filter = filter[, filter...]  (default: none)
+                    noise filters applied in turn to each reading, where
+                    filter is one of
+                      median n - median of the last n readings (odd, 3 - 31)
+                      ema weight - exponential moving average, weighting
+                        each reading by weight (0 - 1)
+                      slew rate - limit the change to rate per second
+                      none - no filter
+                    e.g. filter = median 5, ema 0.3
                  turn_before_run = bool       (default: 1, valid: 0, 1)
                     e.g. turn_before_run = false
                  command_delay = seconds      (default: 1, range: 0 - 10)
                     e.g. command_delay = 0.5
-                 frequency = per_second       (default: 10 range: 1 - 100)
+                 settle_mode = mode           (default: delay)
+                    delay - run the command when the reading has stayed on
+                      its mark for command_delay
+                    predict - also run the command as soon as the dial has
+                      stopped in the select zone of its mark
+                    variance - also run the command as soon as the last
+                      readings vary no more than the noise, in the select
+                      zone of the mark
+                    e.g. settle_mode = predict
+                 settle_velocity = per_second (default: 1000,
+                                               range: 0 - 1000000)
+                    reading change per second below which the dial is
+                    still, for settle_mode predict
+                    e.g. settle_velocity = 500
+                 settle_window = readings     (default: 5, range: 2 - 64)
+                    number of readings to find the velocity of, for
+                    settle_mode predict, or the variance of, for
+                    settle_mode variance
+                    e.g. settle_window = 8
+                 settle_noise = std_dev       (default: 0, range: 0 - 100000)
+                    standard deviation of the readings at rest, for
+                    settle_mode variance, 0 to calibrate automatically
+                    e.g. settle_noise = 12
+                 frequency = per_second       (default: 10 range: 1 - 3300)
                     e.g. frequency = 20
+                 frequency_active = per_second  (same as frequency)
+                 frequency_idle = per_second  (default: 0, range: 0 - 3300)
+                    e.g. frequency_idle = 1
+                 event_wakeup = bool          (default: 0, valid: 0, 1)
+                    e.g. event_wakeup = 1
+                 idle_delay = seconds         (default: 5, range: 0 - 3600)
+                    e.g. idle_delay = 10
                  overlap = percent_band       (default: 5, range: 0 - 50)
                     e.g. overlap = 1
                  enable = bool                (default: 1, valid: 0, 1)
@@ -87,11 +182,79 @@ Options
              and should contain two or more command lines
                  dial_reading_number = command_label, command_to_run
                     e.g.  1245 = Play, mpc -q play
-  -r         report, print configuration report on startup
+             or ranges of marks, a mark every step readings from start
+             to end, where {i} is the number of the mark from 0, {mark} its
+             dial reading, and {value} changes evenly from first to last
+             (default: the same as {i})
+                 start..end step step [values first..last] = label, command
+                    e.g.  100..26300 step 262 values 0..100 =
+                            vol_{value}, mpc -q volume {value}
+  -r         report, print configuration report on startup, and reading
+             schedule statistics at exit (the statistics are also printed
+             to stderr on signal USR1)
+  -t         trace, time the stages from a dial turn to its command for
+             each channel (reading, mark change, settle, command spawn and
+             run) and print histograms of the times at exit (also printed
+             to stderr on signal USR1)
   -m <freq>  monitor , print current dial readings to screen with frequency
              freq
   -d         dry run, no commands are run, -r and -m 10 are set, configuration
              file errors do not cause the program to exit
+  -a <mode>  acquisition mode for reading the ADC
+               threads - one thread per channel, reading the channel value
+                         at the channel frequency (default)
+               scan    - one thread per ADC reading its channels in turn, on
+                         a schedule at the highest channel frequency
+                         (commands run in the background)
+               buffer  - one thread per IIO ADC reading timestamped samples
+                         for its channels from the kernel buffer, at the
+                         highest channel frequency, and a channel with a
+                         lower frequency takes every n'th sample (commands
+                         run in the background)
+               events  - a single thread for all channels and the monitor,
+                         waiting on timers for the channel schedules and
+                         on event driven inputs, and running commands in
+                         the background. Not available with -F
+  -T <name>  IIO trigger for buffer mode, shared by all the devices and
+             running at the highest channel frequency of any device
+             (default: the trigger already set for each device) e.g. an
+             hrtimer trigger created with
+               mkdir /sys/kernel/config/iio/triggers/hrtimer/<name>
+  -i <intf>  ADC interface for adc inputs
+               iio - the ads1015 IIO kernel driver, which makes a single-shot
+                     conversion for each reading (default)
+               i2c[,bus[,address[,chip[,rate]]]] - the ADC is read directly
+                     through /dev/i2c-bus, in continuous-conversion mode.
+                     Optionally give the I2C bus (default: 1), address
+                     (default: 0x48), chip ads1115 or ads1015 (default:
+                     ads1115) and conversions per second (default: chip
+                     default). The kernel driver must not be loaded for
+                     the same ADC. Not available with -a buffer
+                       e.g. -i i2c,1,0x49,ads1015,3300
+  -F         free run, read the inputs without pausing between readings,
+             and simulated inputs use simulated time (for testing)
+  -w <file>  write the raw readings of all enabled channels to a recording
+             file, which can be replayed with 'input = replay file'
+  -E <file>  write the configuration to file as a C++ header, holding the
+             settings, compiled band lookup tables and commands of each
+             channel, and exit. A program built with
+               ./configure --with-builtin-config=/path/to/file
+             uses this configuration when it is run without -c, without
+             reading a configuration file. The build checks that the
+             compiled bands give the same marks as the configuration, and
+             -B checks them against bands compiled when the program runs
+  -B <num>   benchmark, time num reads of each enabled channel with each
+             ADC read method, and num burst reductions for each oversampled
+             channel, check the band lookup table of each channel, and time
+             num band lookups for dials with 2 to 1000 marks, print the
+             results and exit
+  -P <prio>  run the threads that read the dials and select commands with
+             SCHED_FIFO real-time scheduling at priority prio (1 - 99).
+             Commands run with normal scheduling
+  -L         lock the program memory into RAM, so it is never paged out
+  -C <cpus>  run the threads that read the dials on a set of CPUs, given
+             as a comma separated list of CPU numbers and ranges, e.g. 3 or
+             2-3 or 0,3. Commands run on any CPU the program could use
 )",
           get_program_name().c_str(), help_ver_text);
 }
@@ -103,13 +266,14 @@ void DialOpts::process_command_line(int argc, char **argv)
 
   handle_long_opts(argc, argv);
 
-  while ((c = getopt(argc, argv, ":hc:rm:d")) != -1) {
+  while ((c = getopt(argc, argv, ":hc:rtm:da:T:i:Fw:E:B:P:LC:")) != -1) {
     if (common_opts(c, optopt))
       continue;
 
     switch (c) {
     case 'c':
       config_file_name = optarg;
+      config_file_set = true;
       break;
 
     case 'd':
@@ -128,6 +292,57 @@ void DialOpts::process_command_line(int argc, char **argv)
       report = true;
       break;
 
+    case 't':
+      trace = true;
+      break;
+
+    case 'a':
+      print_status_or_exit(get_arg_id(optarg, &acquisition,
+                                      "threads=threads|scan=scan|buffer=buffer|"
+                                      "events=events"),
+                           c);
+      break;
+
+    case 'T':
+      trigger_name = optarg;
+      break;
+
+    case 'i':
+      read_interface(optarg);
+      break;
+
+    case 'F':
+      free_run = true;
+      break;
+
+    case 'w':
+      record_file_name = optarg;
+      break;
+
+    case 'E':
+      cpp_file_name = optarg;
+      break;
+
+    case 'B':
+      print_status_or_exit(read_int(optarg, &benchmark_reads), c);
+      if (benchmark_reads <= 0)
+        error("number of reads must be a positive integer", c);
+      break;
+
+    case 'P':
+      print_status_or_exit(read_int(optarg, &rt_priority), c);
+      if (rt_priority < 1 || rt_priority > 99)
+        error("priority must be an integer from 1 to 99", c);
+      break;
+
+    case 'L':
+      lock_memory = true;
+      break;
+
+    case 'C':
+      read_cpus(optarg);
+      break;
+
     default:
       error("unknown command line error");
     }
@@ -135,23 +350,129 @@ void DialOpts::process_command_line(int argc, char **argv)
 
   if (argc - optind > 0)
     error(msg_str("invalid option or parameter: '%s'", argv[optind]));
+
+  if (free_run && acquisition == "events")
+    error("free run is not available in events acquisition mode", 'F');
 }
 
+void DialOpts::read_cpus(const char *arg)
+{
+  cpus.clear();
+  for (const auto &part : split(arg, ',')) {
+    auto range = split(part, '-');
+    if (range.size() > 2)
+      error("CPU range '" + part + "' should be first-last", 'C');
+    int first, last;
+    print_status_or_exit(read_int(range[0].c_str(), &first), 'C');
+    last = first;
+    if (range.size() > 1)
+      print_status_or_exit(read_int(range[1].c_str(), &last), 'C');
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      error("invalid CPU number or range '" + part + "'", 'C');
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+}
+
+void DialOpts::read_interface(const char *arg)
+{
+  auto parts = split(arg, ',');
+  string intf_id;
+  print_status_or_exit(get_arg_id(parts[0].c_str(), &intf_id, "iio=iio|i2c=i2c",
+                                  argmatch_no_partial),
+                       'i');
+  use_i2c = (intf_id == "i2c");
+  if (!use_i2c) {
+    if (parts.size() > 1)
+      error("iio interface does not take parameters", 'i');
+    return;
+  }
+
+  if (parts.size() > 5)
+    error("i2c interface takes at most four parameters", 'i');
+  char buff;
+  if (parts.size() > 1 &&
+      sscanf(parts[1].c_str(), " %i %c", &i2c_bus, &buff) != 1)
+    error("bus '" + parts[1] + "' is not an integer", 'i');
+  if (parts.size() > 2 &&
+      sscanf(parts[2].c_str(), " %i %c", &i2c_address, &buff) != 1)
+    error("address '" + parts[2] + "' is not an integer", 'i');
+  if (parts.size() > 3)
+    print_status_or_exit(get_arg_id(parts[3].c_str(), &i2c_chip,
+                                    "ads1115=ads1115|ads1015=ads1015"),
+                         'i');
+  if (parts.size() > 4) {
+    print_status_or_exit(read_int(parts[4].c_str(), &i2c_data_rate), 'i');
+    if (i2c_data_rate <= 0)
+      error("rate must be a positive integer", 'i');
+  }
+}
+
+namespace {
+// Handle signals in their own thread. SIGUSR1 prints the reading schedule
+// report and any trace report, SIGINT and SIGTERM write any buffered
+// recorded readings and then end the program as the signal would have.
+void signal_loop(Ads1x15 *adc, sigset_t sigs, bool report, bool trace)
+{
+  while (true) {
+    int sig;
+    if (sigwait(&sigs, &sig) != 0)
+      continue;
+
+    if (sig == SIGUSR1) {
+      fprintf(stderr, "%s", adc->schedule_report().c_str());
+      if (trace)
+        fprintf(stderr, "%s", adc->trace_report().c_str());
+      continue;
+    }
+
+    adc->flush_recording();
+    if (report)
+      printf("%s", adc->schedule_report().c_str());
+    if (trace)
+      printf("%s", adc->trace_report().c_str());
+    fflush(stdout);
+    signal(sig, SIG_DFL);
+    pthread_sigmask(SIG_UNBLOCK, &sigs, nullptr);
+    raise(sig);
+  }
+}
+}; // namespace
+
 int main(int argc, char **argv)
 {
   DialOpts opts;
   opts.process_command_line(argc, argv);
 
+  // A configuration written as C++ does not include the command line
+  // settings
   DialSettings default_settings;
-  default_settings.set_run_commands(!opts.dry_run);
-  default_settings.set_print_commands(opts.report);
+  if (opts.cpp_file_name.empty()) {
+    default_settings.set_run_commands(!opts.dry_run);
+    default_settings.set_print_commands(opts.report);
+  }
 
   Ads1x15 adc;
-  Status stat = adc.read_config_file(opts.config_file_name, default_settings);
+  adc.set_free_run(opts.free_run);
+  if (opts.use_i2c && opts.cpp_file_name.empty()) // not needed to write C++
+    opts.print_status_or_exit(adc.use_i2c(opts.i2c_bus, opts.i2c_address,
+                                          opts.i2c_chip, opts.i2c_data_rate),
+                              "ADC interface");
+  const bool use_builtin =
+      Ads1x15::has_builtin_config() && !opts.config_file_set;
+  if (use_builtin)
+    opts.config_file_name = Ads1x15::builtin_config_name();
+  Status stat = (use_builtin)
+                    ? adc.init_builtin(default_settings)
+                    : adc.read_config_file(opts.config_file_name,
+                                           default_settings);
+  if (stat && opts.cpp_file_name.empty())
+    stat = adc.open_inputs(); // not needed to write the configuration
 
   if (opts.report) {
     printf("\n== Configuration File ==\n");
-    printf("  file name: '%s':\n", opts.config_file_name.c_str());
+    printf("  file name: '%s'%s:\n", opts.config_file_name.c_str(),
+           (use_builtin) ? " (builtin)" : "");
     if (stat.is_ok())
       printf("  ok\n");
     else if (stat.is_warning()) // warn never returned, report all if any added
@@ -163,9 +484,10 @@ int main(int argc, char **argv)
     if (stat.is_error()) {
       if (opts.dry_run) {
         printf("\n  Because of configuration file error, using default values\n"
-               "for all channels for dry run\n");
+               "for ADS1X15 channels a - d for dry run\n");
         default_settings.set_enabled();
-        adc.init(default_settings);
+        adc.init(default_settings, Ads1x15::num_adc_channels);
+        opts.print_status_or_exit(adc.open_inputs());
       }
       else
         exit(1);
@@ -178,13 +500,63 @@ int main(int argc, char **argv)
                               "config file '" + opts.config_file_name + "'");
   }
 
+  if (!opts.cpp_file_name.empty()) {
+    opts.print_status_or_exit(
+        adc.write_cpp(opts.cpp_file_name, opts.config_file_name),
+        "C++ file '" + opts.cpp_file_name + "'");
+    return 0;
+  }
+
+  if (opts.benchmark_reads) {
+    printf("%s", adc.benchmark_report(opts.benchmark_reads).c_str());
+    return 0;
+  }
+
+  if (!opts.record_file_name.empty())
+    opts.print_status_or_exit(adc.record_to(opts.record_file_name),
+                              "recording file");
+
+  adc.set_tracing(opts.trace);
+
+  // Signals are blocked in all threads, and handled by the signal thread.
+  // SIGCHLD is also blocked, for the events mode to read from a signalfd.
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGCHLD);
+  pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGUSR1);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+  std::thread(signal_loop, &adc, sigs, opts.report, opts.trace).detach();
+
   std::thread monitor;
-  if (opts.monitor_freq)
+  if (opts.monitor_freq && opts.acquisition != "events")
     monitor = std::thread(&Ads1x15::monitor_loop, &adc, opts.monitor_freq);
 
+  // Real-time settings apply to this thread and the reading threads it
+  // starts, but not to the signal and monitor threads
+  opts.print_status_or_exit(
+      adc.set_realtime(opts.rt_priority, opts.lock_memory, opts.cpus),
+      "real-time settings");
+
   // opts.print_status_or_exit(adc.start_loop_dry_run('b'));
-  opts.print_status_or_exit(adc.start_loop());
+  if (opts.acquisition == "buffer")
+    opts.print_status_or_exit(adc.start_buffer_loop(opts.trigger_name));
+  else if (opts.acquisition == "events")
+    opts.print_status_or_exit(adc.start_event_loop(opts.monitor_freq));
+  else if (opts.acquisition == "scan")
+    opts.print_status_or_exit(adc.start_scan_loop());
+  else
+    opts.print_status_or_exit(adc.start_loop());
 
-  monitor.join();
+  // All inputs have ended
+  if (monitor.joinable())
+    monitor.detach();
+  if (opts.report)
+    printf("%s", adc.schedule_report().c_str());
+  if (opts.trace)
+    printf("%s", adc.trace_report().c_str());
   return 0;
 }
@@ -0,0 +1,204 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file record.cpp
+   \brief Record raw readings to a file, and replay them as an input
+*/
+
+#include "record.h"
+#include "timer.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace {
+const char record_magic[8] = {'T', 'N', 'R', 'R', 'E', 'C', '\0', '\0'};
+const uint32_t record_version = 1;
+
+int64_t to_usecs(const timeval &tv)
+{
+  return int64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+timeval to_timeval(int64_t usecs)
+{
+  timeval tv;
+  tv.tv_sec = usecs / 1000000;
+  tv.tv_usec = usecs % 1000000;
+  return tv;
+}
+}; // namespace
+
+Recorder::~Recorder()
+{
+  if (file != nullptr)
+    fclose(file);
+}
+
+Status Recorder::open(const string &file_name)
+{
+  file = fopen(file_name.c_str(), "wb");
+  if (file == nullptr)
+    return Status::error("could not create recording file '" + file_name +
+                         "': " + strerror(errno));
+
+  // Readings are timed on the monotonic clock, the header has the
+  // corresponding wall clock time
+  timeval now, wall_now;
+  get_monotonic_time(&now);
+  gettimeofday(&wall_now, 0);
+  start_usecs = to_usecs(now);
+
+  RecordHeader header;
+  memcpy(header.magic, record_magic, sizeof(header.magic));
+  header.version = record_version;
+  header.entry_size = sizeof(RecordEntry);
+  header.start_usecs = to_usecs(wall_now);
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+    return Status::error("could not write recording file '" + file_name + "'");
+
+  return Status::ok();
+}
+
+Status Recorder::write(int channel, long long raw, const timeval &sample_time)
+{
+  RecordEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.usecs = to_usecs(sample_time) - start_usecs;
+  entry.raw = raw;
+  entry.channel = channel;
+
+  std::lock_guard<std::mutex> guard(file_mutex);
+  if (fwrite(&entry, sizeof(entry), 1, file) != 1)
+    return Status::error("could not write to recording file");
+
+  // Flush about once a second, so little is lost if the program is stopped
+  if (entry.usecs - last_flush_usecs > 1000000) {
+    fflush(file);
+    last_flush_usecs = entry.usecs;
+  }
+
+  return Status::ok();
+}
+
+void Recorder::flush()
+{
+  std::lock_guard<std::mutex> guard(file_mutex);
+  if (file != nullptr)
+    fflush(file);
+}
+
+ReplayInput::~ReplayInput()
+{
+  if (map != nullptr)
+    munmap(map, map_size);
+}
+
+Status ReplayInput::init(const string &file_name, int chan, bool free_running)
+{
+  channel = chan;
+  free_run = free_running;
+  description = msg_str("replay channel %c of %s", 'a' + channel,
+                        file_name.c_str());
+
+  int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return Status::error("could not open recording file '" + file_name +
+                         "': " + strerror(errno));
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(RecordHeader)) {
+    map_size = st.st_size;
+    map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+      map = nullptr;
+  }
+  close(fd);
+  if (map == nullptr)
+    return Status::error("could not map recording file '" + file_name + "'");
+
+  const auto header = (const RecordHeader *)map;
+  if (memcmp(header->magic, record_magic, sizeof(record_magic)) != 0 ||
+      header->version != record_version ||
+      header->entry_size != sizeof(RecordEntry))
+    return Status::error("'" + file_name + "' is not a recording file");
+
+  madvise(map, map_size, MADV_SEQUENTIAL);
+  entries = (const RecordEntry *)((const char *)map + sizeof(RecordHeader));
+  end = entries + (map_size - sizeof(RecordHeader)) / sizeof(RecordEntry);
+  cur = next_entry(entries);
+  if (cur == end)
+    return Status::error(msg_str("'%s' has no readings for channel %c",
+                                 file_name.c_str(), 'a' + channel));
+
+  return Status::ok();
+}
+
+const RecordEntry *ReplayInput::next_entry(const RecordEntry *from) const
+{
+  while (from < end && from->channel != channel)
+    from++;
+  return from;
+}
+
+Status ReplayInput::read(long long *raw, timeval *sample_time)
+{
+  timeval now;
+  get_monotonic_time(&now);
+  if (!started) {
+    start = now;
+    started = true;
+  }
+
+  if (free_run) {
+    if (cur == end)
+      return Status::warning("end of replay data");
+    *raw = cur->raw;
+    *sample_time = to_timeval(to_usecs(start) + cur->usecs);
+    cur = next_entry(cur + 1);
+    return Status::ok();
+  }
+
+  // Latest reading recorded at or before the time since replay started
+  const int64_t elapsed = to_usecs(now) - to_usecs(start) + entries->usecs;
+  while (cur < end && cur->usecs <= elapsed) {
+    last = cur;
+    cur = next_entry(cur + 1);
+  }
+  if (cur == end && last != nullptr && elapsed > last->usecs + 1000000)
+    return Status::warning("end of replay data");
+
+  *raw = (last != nullptr) ? last->raw : cur->raw;
+  *sample_time = now;
+  return Status::ok();
+}
+
+string ReplayInput::get_description() const { return description; }
@@ -0,0 +1,121 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file record.h
+   \brief Record raw readings to a file, and replay them as an input
+*/
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "input.h"
+#include "status_msg.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <sys/time.h>
+
+/// Header at the start of a recording file
+struct RecordHeader {
+  char magic[8];        ///< "TNRREC" followed by two zero bytes
+  uint32_t version;     ///< format version
+  uint32_t entry_size;  ///< size of each RecordEntry
+  int64_t start_usecs;  ///< time of the start of the recording (epoch)
+};
+
+/// A reading in a recording file (native byte order)
+struct RecordEntry {
+  int64_t usecs;      ///< time of the reading after the recording start
+  int32_t raw;        ///< raw reading
+  uint8_t channel;    ///< channel index (0 for channel a)
+  uint8_t unused[3];  ///< padding
+};
+
+/// Write raw readings from any number of channels to a recording file
+class Recorder {
+public:
+  /// Destructor, closes the file
+  ~Recorder();
+
+  /// Create the recording file
+  /**\param file_name the name of the file
+   * \return status, evaluates to \c true if the file was created. */
+  Status open(const std::string &file_name);
+
+  /// Append a reading (may be called from several threads)
+  /**\param channel the channel index
+   * \param raw the raw reading
+   * \param sample_time the time the reading was taken
+   * \return status, evaluates to \c true if the reading was written. */
+  Status write(int channel, long long raw, const timeval &sample_time);
+
+  /// Write any buffered readings to the file (may be called from any thread)
+  void flush();
+
+private:
+  FILE *file = nullptr;
+  std::mutex file_mutex;
+  int64_t start_usecs = 0;      // monotonic time of the recording start
+  int64_t last_flush_usecs = 0; // time of last flush, relative to start
+};
+
+/// Input source replaying one channel of a recording file
+class ReplayInput : public InputSource {
+public:
+  /// Destructor, unmaps the file
+  ~ReplayInput();
+
+  /// Map the recording file
+  /**\param file_name the name of the recording file
+   * \param channel the channel index to replay
+   * \param free_run if \c true then each reading is returned in turn with
+   *  its recorded time, otherwise the latest reading at the time since
+   *  replay started is returned with the current time
+   * \return status, evaluates to \c true if the file was mapped. */
+  Status init(const std::string &file_name, int channel, bool free_run);
+
+  /// Read the next raw value
+  /**\return status, a warning when there are no more readings.*/
+  Status read(long long *raw, timeval *sample_time) override;
+  std::string get_description() const override;
+
+private:
+  const RecordEntry *next_entry(const RecordEntry *from) const;
+
+  void *map = nullptr;                // mapped file
+  size_t map_size = 0;                // size of mapped file
+  const RecordEntry *entries = nullptr; // first entry
+  const RecordEntry *end = nullptr;     // end of entries
+  const RecordEntry *cur = nullptr;     // next entry for the channel
+  const RecordEntry *last = nullptr;    // last entry returned
+  int channel = 0;                    // channel to replay
+  bool free_run = false;              // replay without pausing
+  bool started = false;               // first reading has been made
+  timeval start;                      // time replay started
+  std::string description;
+};
+
+#endif // RECORD_H
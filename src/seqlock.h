@@ -0,0 +1,110 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file seqlock.h
+   \brief Sequence lock, for a single writer to publish a value to readers
+*/
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/// Value published by one writer and read by any thread without a lock
+/** The writer never waits for a reader. A reader copies the value, and
+ *  copies it again if the writer changed it during the copy, so it always
+ *  gets a value that was stored whole. The value is held in atomic words,
+ *  so a copy that overlaps a store is not a data race. */
+template <typename T> class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SeqLock value must be trivially copyable");
+
+public:
+  /// Constructor
+  /**\param val the initial value. */
+  explicit SeqLock(const T &val = T()) { store(val); }
+
+  /// Store a value, only called by the writer thread
+  /**\param val the value. */
+  void store(const T &val)
+  {
+    uint64_t buf[num_words] = {};
+    memcpy(buf, &val, sizeof(T));
+    const unsigned start = seq.load(std::memory_order_relaxed);
+    seq.store(start + 1, std::memory_order_relaxed); // odd while storing
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < num_words; i++)
+      words[i].store(buf[i], std::memory_order_relaxed);
+    seq.store(start + 2, std::memory_order_release);
+  }
+
+  /// Load the value, from any thread
+  /**\return The last value stored. */
+  T load() const
+  {
+    T val;
+    load(&val);
+    return val;
+  }
+
+  /// Get the sequence number
+  /** The number changes with each store, so a reader can check whether the
+   *  value changed since it was loaded.
+   * \return The sequence number, which is even when no store is under way. */
+  unsigned sequence() const { return seq.load(std::memory_order_acquire); }
+
+  /// Load the value, and the sequence number it was stored with
+  /**\param val used to return the value
+   * \return The sequence number of the value. */
+  unsigned load(T *val) const
+  {
+    uint64_t buf[num_words];
+    unsigned start;
+    while (!try_load(buf, &start))
+      ;
+    memcpy(val, buf, sizeof(T));
+    return start;
+  }
+
+private:
+  static constexpr size_t num_words = (sizeof(T) + 7) / 8;
+  std::atomic<unsigned> seq{0};
+  std::atomic<uint64_t> words[num_words];
+
+  bool try_load(uint64_t *buf, unsigned *start) const
+  {
+    *start = seq.load(std::memory_order_acquire);
+    if (*start & 1)
+      return false; // store under way
+    for (size_t i = 0; i < num_words; i++)
+      buf[i] = words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq.load(std::memory_order_relaxed) == *start;
+  }
+};
+
+#endif // SEQLOCK_H
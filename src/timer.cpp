@@ -27,11 +27,17 @@
 */
 
 #include "timer.h"
-#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
 
 namespace { // unnamed namespace
 
-long to_long_usecs(timeval tv) { return tv.tv_sec * 1000000 + tv.tv_usec; }
+long long to_long_usecs(timeval tv)
+{
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
 
 double to_double_secs(timeval tv) { return tv.tv_sec + tv.tv_usec / 1000000.0; }
 
@@ -78,46 +84,193 @@ timeval to_timeval(double tm)
   return tv;
 }
 
+long long to_nsecs(const timespec &ts)
+{
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+timespec to_timespec(long long ns)
+{
+  timespec ts;
+  ts.tv_sec = ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  return ts;
+}
+
+long long monotonic_nsecs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return to_nsecs(ts);
+}
+
+// Sleep until an absolute time on the monotonic clock
+void sleep_until(const timespec &ts)
+{
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+         EINTR)
+    ;
+}
+
 }; // unnamed namespace
 
+void get_monotonic_time(timeval *tv)
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  tv->tv_sec = ts.tv_sec;
+  tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+void sleep_until_time(const timeval &tv)
+{
+  timespec ts;
+  ts.tv_sec = tv.tv_sec;
+  ts.tv_nsec = tv.tv_usec * 1000;
+  sleep_until(ts);
+}
+
 void Timer::set_timer(timeval interval)
 {
   timeval tv;
-  gettimeofday(&tv, 0);
+  get_monotonic_time(&tv);
   end = tv + interval;
 }
 
 void Timer::set_timer(double interval) { set_timer(to_timeval(interval)); }
 
+void Timer::set_timer(double interval, const timeval &from)
+{
+  end = from + to_timeval(interval);
+}
+
 void Timer::inc_timer(double inc) { end = end + to_timeval(inc); }
 
 bool Timer::finished()
 {
   timeval tv;
-  gettimeofday(&tv, 0);
+  get_monotonic_time(&tv);
   return tv > end;
 }
 
-void Timer::sleep_until_finished()
+bool Timer::finished(const timeval &now) const { return !(end > now); }
+
+double Timer::remaining() const
 {
   timeval tv;
-  gettimeofday(&tv, 0);
-  if (end > tv)
-    sleep(to_long_usecs(end - tv));
+  get_monotonic_time(&tv);
+  return (end > tv) ? to_double_secs(end - tv) : 0.0;
 }
 
-void Counter::reset() { gettimeofday(&start, 0); }
+void Timer::sleep_until_finished() { sleep_until_time(end); }
+
+void Counter::reset() { get_monotonic_time(&start); }
 
 long Counter::usecs() const
 {
   timeval tv;
-  gettimeofday(&tv, 0);
+  get_monotonic_time(&tv);
   return to_long_usecs(tv - start);
 }
 
+long Counter::usecs(const timeval &now) const
+{
+  return to_long_usecs(now) - to_long_usecs(start);
+}
+
 double Counter::secs() const
 {
   timeval tv;
-  gettimeofday(&tv, 0);
+  get_monotonic_time(&tv);
   return to_double_secs(tv - start);
 }
+
+void Ticker::start(double period)
+{
+  set_period(period);
+  restart();
+}
+
+void Ticker::set_period(double period)
+{
+  period_ns = std::max(1LL, (long long)(period * 1e9));
+  stats.period = period;
+}
+
+void Ticker::restart() { next_ns = monotonic_nsecs(); }
+
+bool Ticker::sleep_until_next()
+{
+  next_ns += period_ns;
+  long long now_ns = monotonic_nsecs();
+  const bool on_time = now_ns <= next_ns;
+  if (!on_time) { // skip the ticks that have passed
+    long long missed = (now_ns - next_ns) / period_ns + 1;
+    next_ns += missed * period_ns;
+    stats.overruns++;
+    stats.missed += missed;
+  }
+
+  sleep_until(to_timespec(next_ns));
+
+  const double late = (monotonic_nsecs() - next_ns) / 1e9;
+  stats.ticks++;
+  stats.late_sum += late;
+  stats.late_max = std::max(stats.late_max, late);
+  return on_time;
+}
+
+timeval Ticker::get_next_tick() const
+{
+  const long long ns = next_ns + period_ns;
+  timeval tv;
+  tv.tv_sec = ns / 1000000000;
+  tv.tv_usec = (ns % 1000000000) / 1000;
+  return tv;
+}
+
+void DeadlineQueue::set(int id, const timeval &deadline)
+{
+  if (id >= (int)items.size())
+    items.resize(id + 1);
+  auto &item = items[id];
+  const long long usecs = to_long_usecs(deadline);
+  if (item.pending && item.usecs == usecs)
+    return; // already in the heap
+  item = {++item.gen, usecs, true};
+  heap.push({usecs, id, item.gen});
+}
+
+void DeadlineQueue::cancel(int id)
+{
+  if (id < (int)items.size() && items[id].pending) {
+    items[id].gen++;
+    items[id].pending = false;
+  }
+}
+
+void DeadlineQueue::discard_stale()
+{
+  while (!heap.empty() && heap.top().gen != items[heap.top().id].gen)
+    heap.pop();
+}
+
+bool DeadlineQueue::next(timeval *deadline, int *id)
+{
+  discard_stale();
+  if (heap.empty())
+    return false;
+  deadline->tv_sec = heap.top().usecs / 1000000;
+  deadline->tv_usec = heap.top().usecs % 1000000;
+  *id = heap.top().id;
+  return true;
+}
+
+void DeadlineQueue::pop()
+{
+  discard_stale();
+  if (!heap.empty()) {
+    cancel(heap.top().id);
+    heap.pop();
+  }
+}
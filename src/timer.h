@@ -29,7 +29,19 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include <queue>
 #include <sys/time.h>
+#include <vector>
+
+/// Get the current time
+/** All timing uses the monotonic clock, which is not changed by setting
+ *  the system time, e.g. by NTP after booting without a real time clock.
+ * \param tv used to return the time since an unspecified start. */
+void get_monotonic_time(timeval *tv);
+
+/// Sleep until a time
+/**\param tv the time on the monotonic clock (see get_monotonic_time()). */
+void sleep_until_time(const timeval &tv);
 
 /// A subsecond %Timer
 class Timer {
@@ -49,6 +61,12 @@ public:
    * should run. */
   void set_timer(double interval);
 
+  /// Set the %Timer to run from a given time.
+  /**\param interval length of time in seconds that the %Timer
+   * should run.
+   * \param from the time the %Timer starts. */
+  void set_timer(double interval, const timeval &from);
+
   /// Increment the %Timer.
   /**\param inc length of time in microseconds that the %Timer
    * should be extended. */
@@ -58,6 +76,20 @@ public:
   /**\return \c true if the %timer has finished, otherwise \c false. */
   bool finished();
 
+  /// Check whether the %timer had finished at a given time.
+  /**\param now the time to check, the %timer has finished at its end time.
+   * \return \c true if the %timer had finished, otherwise \c false. */
+  bool finished(const timeval &now) const;
+
+  /// Get the end time.
+  /**\return The time the %timer finishes. */
+  timeval get_end() const { return end; }
+
+  /// Get the time remaining.
+  /**\return The number of seconds until the %timer finishes, or 0 if
+   * it has finished. */
+  double remaining() const;
+
   /// Sleep until finished.
   /**Pause program execution for the amount of time remaining
    * on the %timer. */
@@ -78,6 +110,19 @@ public:
   /// Reset and start the %Counter.
   void reset();
 
+  /// Reset the %Counter to start from a given time.
+  /**\param from the start time on the monotonic clock. */
+  void reset(const timeval &from) { start = from; }
+
+  /// Get the start time.
+  /**\return The time the %Counter started, on the monotonic clock. */
+  timeval get_start() const { return start; }
+
+  /// Get the number of usecs from the %Counter start to a given time
+  /**\param now the time on the monotonic clock
+   * \return The number of usecs, negative if \a now is before the start. */
+  long usecs(const timeval &now) const;
+
   /// Get the number of usecs since the %Counter started
   /**\return The number of usecs since the Counter started */
   long usecs() const;
@@ -87,4 +132,97 @@ public:
   double secs() const;
 };
 
+/// Statistics for a %Ticker schedule
+struct TickStats {
+  long ticks = 0;        ///< number of ticks
+  long overruns = 0;     ///< number of times the next tick had passed
+  long missed = 0;       ///< number of ticks skipped after overruns
+  double late_sum = 0;   ///< total seconds woken after the tick time
+  double late_max = 0;   ///< most seconds woken after the tick time
+  double period = 0;     ///< seconds between ticks
+};
+
+/// A drift-free periodic schedule on the monotonic clock
+/** Each tick is an absolute deadline a whole number of periods after the
+ *  start, so the time taken between ticks does not delay the schedule. */
+class Ticker {
+private:
+  long long next_ns = 0;   // time of the next tick
+  long long period_ns = 0; // time between ticks
+  TickStats stats;
+
+public:
+  /// Constructor
+  /**\param period seconds between ticks. */
+  Ticker(double period = 1.0) { start(period); }
+
+  /// Start the schedule, the first tick is now
+  /**\param period seconds between ticks. */
+  void start(double period);
+
+  /// Change the period, from the last tick, keeping the statistics
+  /**\param period seconds between ticks. */
+  void set_period(double period);
+
+  /// Restart the schedule from now, keeping the period and statistics
+  void restart();
+
+  /// Sleep until the next tick
+  /**If the next tick has already passed then it is an overrun, and
+   * the ticks that have passed are skipped, so that later ticks stay
+   * on the schedule.
+   * \return \c true if the tick was on time, \c false if it overran. */
+  bool sleep_until_next();
+
+  /// Get the time of the next tick
+  /**\return The time on the monotonic clock. */
+  timeval get_next_tick() const;
+
+  /// Get the schedule statistics
+  /**\return The statistics. */
+  const TickStats &get_stats() const { return stats; }
+};
+
+/// Deadlines for a set of items, such as channels, earliest first
+/** Deadlines are kept in a min-heap. Changing or cancelling the deadline
+ *  for an item leaves the old entry in the heap, and it is discarded when
+ *  it reaches the top. Setting an unchanged deadline does not add an entry,
+ *  so an item may be set after every reading. */
+class DeadlineQueue {
+public:
+  /// Set the deadline for an item, replacing any deadline it already has
+  /**\param id the item, a small non-negative integer
+   * \param deadline the deadline time. */
+  void set(int id, const timeval &deadline);
+
+  /// Cancel the deadline for an item, if it has one
+  /**\param id the item. */
+  void cancel(int id);
+
+  /// Get the earliest deadline
+  /**\param deadline used to return the deadline time
+   * \param id used to return the item
+   * \return \c true if there is a deadline, otherwise \c false. */
+  bool next(timeval *deadline, int *id);
+
+  /// Remove the earliest deadline
+  void pop();
+
+private:
+  struct Entry {
+    long long usecs;  // deadline time
+    int id;           // item
+    unsigned gen;     // item generation when the deadline was set
+    bool operator<(const Entry &other) const { return usecs > other.usecs; }
+  };
+  struct Item {
+    unsigned gen = 0;     // generation, changed when the deadline changes
+    long long usecs = 0;  // deadline time
+    bool pending = false; // has a deadline in the heap
+  };
+  std::priority_queue<Entry> heap;
+  std::vector<Item> items; // current state of each item
+  void discard_stale();
+};
+
 #endif // TIMER_H
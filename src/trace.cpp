@@ -0,0 +1,98 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file trace.cpp
+   \brief Latency histograms for the stages from a turn to a command
+*/
+
+#include "trace.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::string;
+
+int LatencyHistogram::bucket(long usecs)
+{
+  // Values below 2^sub_bits have a bucket each, otherwise the bucket is
+  // given by the top bit and the sub_bits bits below it
+  if (usecs < (1L << sub_bits))
+    return usecs;
+  const int top_bit = 63 - __builtin_clzl(usecs);
+  const int shift = top_bit - sub_bits;
+  const int sub = (usecs >> shift) & ((1 << sub_bits) - 1);
+  return ((shift + 1) << sub_bits) + sub;
+}
+
+long LatencyHistogram::bucket_max(int idx)
+{
+  if (idx < (1 << sub_bits))
+    return idx;
+  const int shift = (idx >> sub_bits) - 1;
+  const long sub = idx & ((1 << sub_bits) - 1);
+  return (((1L << sub_bits) + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::add(long usecs)
+{
+  usecs = std::max(0L, usecs);
+  counts[bucket(usecs)]++;
+  min_usecs = total ? std::min(min_usecs, usecs) : usecs;
+  max_usecs = std::max(max_usecs, usecs);
+  total++;
+}
+
+long LatencyHistogram::percentile(double pc) const
+{
+  if (total == 0)
+    return 0;
+  const long rank = std::max(1L, std::lround(std::ceil(total * pc / 100)));
+  long seen = 0;
+  for (int idx = 0; idx < num_buckets; idx++) {
+    seen += counts[idx];
+    if (seen >= rank)
+      return std::min(bucket_max(idx), max_usecs);
+  }
+  return max_usecs;
+}
+
+string StageTrace::report(const string &indent) const
+{
+  const char *names[num_stages] = {"read",  "mark", "settle",
+                                   "spawn", "run",  "turn to action"};
+  auto ms = [](long usecs) { return usecs / 1000.0; };
+  string str = msg_str("%s%-15s %7s %10s %10s %10s %10s\n", indent.c_str(),
+                       "stage (ms)", "count", "min", "p50", "p99", "max");
+  for (int i = 0; i < num_stages; i++) {
+    const auto &hist = hists[i];
+    str += msg_str("%s%-15s %7ld", indent.c_str(), names[i], hist.count());
+    if (hist.count())
+      str += msg_str(" %10.3f %10.3f %10.3f %10.3f", ms(hist.min()),
+                     ms(hist.percentile(50)), ms(hist.percentile(99)),
+                     ms(hist.max()));
+    str += "\n";
+  }
+  return str;
+}
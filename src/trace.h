@@ -0,0 +1,103 @@
+/*
+   Copyright (c) 2021, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+/**\file trace.h
+   \brief Latency histograms for the stages from a turn to a command
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <array>
+#include <string>
+
+/// Histogram of durations in microseconds
+/** Durations are counted in buckets that are 1/8 of a power of two wide,
+ *  so percentiles are within 12.5% of the true value. The minimum and
+ *  maximum are exact. */
+class LatencyHistogram {
+public:
+  /// Add a duration
+  /**\param usecs the duration, negative durations are counted as 0. */
+  void add(long usecs);
+
+  /// Get the number of durations added
+  /**\return The number of durations. */
+  long count() const { return total; }
+
+  /// Get the shortest duration
+  /**\return The duration, or 0 if none were added. */
+  long min() const { return total ? min_usecs : 0; }
+
+  /// Get the longest duration
+  /**\return The duration, or 0 if none were added. */
+  long max() const { return max_usecs; }
+
+  /// Get a percentile duration
+  /**\param pc the percentage of durations at or below the returned value
+   * \return The upper limit of the bucket holding the percentile, but no
+   *  more than the maximum, or 0 if none were added. */
+  long percentile(double pc) const;
+
+private:
+  static const int sub_bits = 3; // sub-buckets per power of two, as bits
+  static const int num_buckets = (64 - sub_bits) << sub_bits;
+  static int bucket(long usecs);
+  static long bucket_max(int idx);
+
+  std::array<long, num_buckets> counts = {};
+  long total = 0;
+  long min_usecs = 0;
+  long max_usecs = 0;
+};
+
+/// Latency of each stage from a dial turn to its command finishing
+class StageTrace {
+public:
+  /// Stages, each timed from the end of the previous stage
+  enum Stage {
+    read,   ///< input read, from the start to the end of the read
+    mark,   ///< mark change, from the reading sample time to processing
+    settle, ///< settle, from the mark change to the command being selected
+    spawn,  ///< spawn, from selection to the command process starting
+    run,    ///< run, from the process starting to its exit being seen
+    total,  ///< turn to action, from the reading sample time to spawn
+    num_stages
+  };
+
+  /// Add a duration for a stage
+  /**\param stage the stage
+   * \param usecs the duration. */
+  void add(Stage stage, long usecs) { hists[stage].add(usecs); }
+
+  /// Get a report with a line for each stage
+  /**\param indent the text to start each line with
+   * \return The report. */
+  std::string report(const std::string &indent) const;
+
+private:
+  std::array<LatencyHistogram, num_stages> hists;
+};
+
+#endif // TRACE_H
@@ -31,6 +31,7 @@
 #include <ctype.h>
 #include <limits.h>
 #include <math.h>
+#include <sstream>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -78,6 +79,28 @@ Status read_int(const char *str, int *i)
   return Status::ok();
 }
 
+vector<string> split(const string &str, char delim)
+{
+  vector<string> parts;
+  string::size_type start = 0, pos;
+  while ((pos = str.find(delim, start)) != string::npos) {
+    parts.push_back(str.substr(start, pos - start));
+    start = pos + 1;
+  }
+  parts.push_back(str.substr(start));
+  return parts;
+}
+
+vector<string> split_words(const string &str)
+{
+  vector<string> words;
+  std::istringstream stream(str);
+  string word;
+  while (stream >> word)
+    words.push_back(word);
+  return words;
+}
+
 // https://stackoverflow.com/questions/2342162/stdstring-formatting-
 // like-sprintf/49812018#49812018
 string msg_str(const char *fmt, ...)
@@ -54,6 +54,18 @@ Status read_double(const char *str, double *f);
  *  was read, otherwise \c false.*/
 Status read_int(const char *str, int *i);
 
+/// Split a string into parts at a delimiter
+/**\param str the string to split
+ * \param delim the delimiter character
+ * \return The parts, without the delimiters (an empty string gives
+ *  one empty part). */
+std::vector<std::string> split(const std::string &str, char delim);
+
+/// Split a string into whitespace separated words
+/**\param str the string to split, e.g. an input or filter specification
+ * \return The words. */
+std::vector<std::string> split_words(const std::string &str);
+
 /// Join strings into a single string, with parts separated by a delimiter
 /**\param iterator to first string in sequence
  * \param iterator to end of string sequence